@@ -0,0 +1,26 @@
+# PlatformIO post-build check: fail when the firmware's static data leaves
+# less than custom_ram_margin bytes of SRAM for the stack. MEMORY_REPORT
+# shows how much of that margin a running show really uses.
+import subprocess
+import sys
+
+Import("env")
+
+
+def check_ram(source, target, env):
+    output = subprocess.check_output([env.subst("$SIZETOOL"), "-A", str(source[0])])
+    used = 0
+    for line in output.decode().splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] in (".data", ".bss", ".noinit"):
+            used += int(fields[1])
+
+    ram = int(env.BoardConfig().get("upload.maximum_ram_size"))
+    margin = int(env.GetProjectOption("custom_ram_margin"))
+    print("SRAM: %d bytes static, %d left for the stack, %d required" % (used, ram - used, margin))
+    if ram - used < margin:
+        sys.stderr.write("Error: the stack margin is under custom_ram_margin\n")
+        env.Exit(1)
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_ram)
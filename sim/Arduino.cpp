@@ -0,0 +1,272 @@
+/*
+  Mock Arduino core for the host simulator.
+
+  random() reproduces avr-libc's Park-Miller generator and Arduino's range
+  mapping, so a given seed gives the same show on the host as on the
+  board. analogRead() returns deterministic noise. The EEPROM starts out
+  erased and writes finish instantly.
+*/
+
+#include <stdio.h>
+#include "Arduino.h"
+
+// Cycle figures are estimates for comparing builds, not measurements.
+const SimOpInfo simOps[simOpCount] = {
+    {"millis", 30},
+    {"micros", 60},
+    {"analogWrite", 110},
+    {"digitalWrite", 70},
+    {"pinMode", 70},
+    {"analogRead", 1760},
+    {"random", 900},
+    {"flash read", 3},
+    {"cos", 2600},
+    {"eeprom write", 40},
+    {"channel", 45},
+    {"mul 8x8", 6},
+    {"mul 16x16", 30},
+    {"mul 16x32", 70},
+    {"div 32-bit", 600},
+    {"xorshift", 20},
+    {"queue op", 35},
+    {"heap swap", 25}
+};
+
+unsigned long simOpCounts[simOpCount];
+
+uint64_t simMicrosNow = 0;
+unsigned long simFrames = 0;
+uint16_t simFrameRate = 0;
+uint32_t simOutputHash = 2166136261u;
+uint64_t simPoweredDownMicros = 0;
+
+HardwareSerial Serial;
+
+static uint8_t eeprom[E2END + 1];
+static bool eepromErased = false;
+
+static int32_t randomState = 1;
+static uint32_t noiseState = 0x2545f491;
+
+void simResetCounts()
+{
+    memset(simOpCounts, 0, sizeof(simOpCounts));
+    simFrames = 0;
+}
+
+void simSeedNoise(uint32_t seed)
+{
+    noiseState = seed ? seed : 0x2545f491;
+}
+
+void simWaitForFrame(uint16_t rateHz)
+{
+    simFrameRate = rateHz;
+    ++simFrames;
+
+    // Frame n starts at n * 1e6 / rate, so the average rate is exact.
+    uint64_t frame = simMicrosNow * rateHz / 1000000 + 1;
+    simMicrosNow = (frame * 1000000 + rateHz - 1) / rateHz;
+}
+
+void simPowerDown(uint16_t ms)
+{
+    simMicrosNow += uint64_t(ms) * 1000;
+    simPoweredDownMicros += uint64_t(ms) * 1000;
+}
+
+static FILE* traceFile = nullptr;
+
+bool simOpenTrace(const char* path)
+{
+    traceFile = fopen(path, "wb");
+    return traceFile != nullptr;
+}
+
+void simTraceWrite(uint8_t byte)
+{
+    if (traceFile)
+    {
+        fputc(byte, traceFile);
+    }
+}
+
+static void hashOutput(uint8_t pin, int value)
+{
+    uint32_t words[3] = {uint32_t(simMicrosNow / 1000), pin, uint32_t(value)};
+    for (uint32_t word : words)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            simOutputHash = (simOutputHash ^ ((word >> (8 * i)) & 0xff)) * 16777619u;
+        }
+    }
+}
+
+unsigned long millis()
+{
+    simCount(simOpMillis);
+    return (unsigned long)((simMicrosNow - simPoweredDownMicros) / 1000);
+}
+
+unsigned long micros()
+{
+    simCount(simOpMicros);
+    return (unsigned long)(simMicrosNow - simPoweredDownMicros);
+}
+
+void delay(unsigned long ms)
+{
+    simMicrosNow += uint64_t(ms) * 1000;
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+    simCount(simOpPinMode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    simCount(simOpDigitalWrite);
+    hashOutput(pin, value ? 255 : 0);
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+    simCount(simOpAnalogWrite);
+    hashOutput(pin, value);
+}
+
+int analogRead(uint8_t)
+{
+    simCount(simOpAnalogRead);
+    noiseState ^= noiseState << 13;
+    noiseState ^= noiseState >> 17;
+    noiseState ^= noiseState << 5;
+    return noiseState & 0x3ff;
+}
+
+// avr-libc do_random(): x = 16807 * x mod (2^31 - 1) via Schrage's method.
+static int32_t avrRandom()
+{
+    int32_t x = randomState;
+    if (x == 0)
+    {
+        x = 123459876;
+    }
+    int32_t hi = x / 127773;
+    int32_t lo = x % 127773;
+    x = 16807 * lo - 2836 * hi;
+    if (x < 0)
+    {
+        x += 0x7fffffff;
+    }
+    randomState = x;
+    return x;
+}
+
+long random(long howbig)
+{
+    simCount(simOpRandom);
+    if (howbig == 0)
+    {
+        return 0;
+    }
+    return avrRandom() % howbig;
+}
+
+long random(long howsmall, long howbig)
+{
+    if (howsmall >= howbig)
+    {
+        return howsmall;
+    }
+    return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed)
+{
+    if (seed != 0)
+    {
+        randomState = int32_t(uint32_t(seed));
+    }
+}
+
+static uint8_t* eepromCell(const void* addr)
+{
+    if (!eepromErased)
+    {
+        memset(eeprom, 0xff, sizeof(eeprom));
+        eepromErased = true;
+    }
+    return &eeprom[uintptr_t(addr) & E2END];
+}
+
+uint8_t eeprom_read_byte(const uint8_t* addr)
+{
+    return *eepromCell(addr);
+}
+
+void eeprom_read_block(void* dest, const void* src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        ((uint8_t*)dest)[i] = eeprom_read_byte((const uint8_t*)src + i);
+    }
+}
+
+void eeprom_update_byte(uint8_t* addr, uint8_t value)
+{
+    simCount(simOpEepromWrite);
+    *eepromCell(addr) = value;
+}
+
+bool eeprom_is_ready()
+{
+    return true;
+}
+
+int HardwareSerial::available()
+{
+    return 0;
+}
+
+int HardwareSerial::read()
+{
+    return -1;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t HardwareSerial::print(const char* s)
+{
+    return fputs(s, stdout) < 0 ? 0 : strlen(s);
+}
+
+size_t HardwareSerial::print(char c)
+{
+    return write(c);
+}
+
+size_t HardwareSerial::print(long n, int base)
+{
+    return base == HEX ? printf("%lx", (unsigned long)n) : printf("%ld", n);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base)
+{
+    return printf(base == HEX ? "%lx" : "%lu", n);
+}
+
+size_t HardwareSerial::print(int n, int base)
+{
+    return print(long(n), base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base)
+{
+    return print((unsigned long)n, base);
+}
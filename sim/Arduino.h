@@ -0,0 +1,96 @@
+/*
+  Arduino
+
+  Minimal mock of the Arduino AVR core, enough to build the sketch on the
+  host. Every call is counted in SimCore so the harness can report what a
+  frame would cost on the board.
+*/
+
+#pragma once
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "SimCore.h"
+
+#define FALCON_SIM
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define PROGMEM
+#define pgm_read_byte(addr) (simCount(simOpFlashRead), *(const uint8_t*)(addr))
+#define pgm_read_word(addr) (simCount(simOpFlashRead), *(const uint16_t*)(addr))
+#define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
+#define F(s) (s)
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void analogWrite(uint8_t pin, int value);
+int analogRead(uint8_t pin);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// 1 KB of EEPROM, like the ATmega328.
+#define E2END 0x3ff
+uint8_t eeprom_read_byte(const uint8_t* addr);
+void eeprom_read_block(void* dest, const void* src, size_t n);
+void eeprom_update_byte(uint8_t* addr, uint8_t value);
+bool eeprom_is_ready();
+
+// Count soft-float cos() calls made by the FLOAT_WAVEFORM path.
+inline double simCountedCos(double x)
+{
+    simCount(simOpCos);
+    return ::cos(x);
+}
+#define cos simCountedCos
+
+class HardwareSerial
+{
+  public:
+    void begin(unsigned long)
+    {
+    }
+
+    int available();
+    int read();
+
+    size_t write(uint8_t c);
+    size_t print(const char* s);
+    size_t print(char c);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+
+    template <class T>
+    size_t println(T value)
+    {
+        return print(value) + print('\n');
+    }
+
+    size_t println()
+    {
+        return print('\n');
+    }
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,68 @@
+/*
+  SimCore
+
+  Host-side state behind the mock Arduino core: the simulated clock, a
+  counter per core call and per unit of animation math (see
+  src/SimCost.h), and a checksum of everything written to the
+  outputs. The benchmark harness in main.cpp reads these.
+*/
+
+#pragma once
+#include <stdint.h>
+
+enum SimOp : uint8_t
+{
+    simOpMillis,
+    simOpMicros,
+    simOpAnalogWrite,
+    simOpDigitalWrite,
+    simOpPinMode,
+    simOpAnalogRead,
+    simOpRandom,
+    simOpFlashRead,
+    simOpCos,
+    simOpEepromWrite,
+    simOpChannel,
+    simOpMul8,
+    simOpMul16,
+    simOpMul32,
+    simOpDivide,
+    simOpXorshift,
+    simOpQueue,
+    simOpHeapSwap,
+    simOpCount
+};
+
+struct SimOpInfo
+{
+    const char* name;
+    uint16_t avrCycles;    // rough cost of one call on a 16 MHz ATmega328
+};
+
+extern const SimOpInfo simOps[simOpCount];
+extern unsigned long simOpCounts[simOpCount];
+
+extern uint64_t simMicrosNow;
+extern unsigned long simFrames;
+extern uint16_t simFrameRate;
+extern uint32_t simOutputHash;
+extern uint64_t simPoweredDownMicros;
+
+inline void simCount(SimOp op)
+{
+    ++simOpCounts[op];
+}
+
+void simResetCounts();
+void simSeedNoise(uint32_t seed);
+
+// Stands in for the frame timer: advances the clock to the next frame.
+void simWaitForFrame(uint16_t rateHz);
+
+// Stands in for a watchdog power-down: the clock jumps ms ahead, and
+// millis() doesn't see it, as Timer0 is stopped.
+void simPowerDown(uint16_t ms);
+
+// Where an OUTPUT_TRACE build's trace goes; nowhere until opened.
+bool simOpenTrace(const char* path);
+void simTraceWrite(uint8_t byte);
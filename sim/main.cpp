@@ -0,0 +1,85 @@
+/*
+  Falcon host simulator
+
+  Runs the sketch's setup() and loop() against the mock Arduino core,
+  with the clock jumping one frame per loop(), so hours of show time run
+  in seconds. Afterwards it reports how many of each core call a frame
+  makes, what that would cost on the ATmega328 by the estimates in
+  Arduino.cpp, and a checksum of every output write. Two builds with the
+  same checksum produced the same light show.
+
+  Build and run with PlatformIO:
+      pio run -e native && .pio/build/native/program [seconds] [seed] [trace]
+  or directly:
+      g++ -std=gnu++11 -O2 -Isim -Isrc src/Falcon.cpp sim/Arduino.cpp sim/main.cpp -o falcon-sim
+
+  Built with -DOUTPUT_TRACE, the sketch's output trace is written to the
+  trace file. A trace recorded before a change is the golden one to diff
+  the trace after it against, with tracediff:
+      g++ -std=gnu++11 -O2 -Isim -Isrc sim/tracediff.cpp -o tracediff
+      ./tracediff golden.trace new.trace
+
+  The cycle figures cover core calls, flash reads, soft-float cos() and the
+  animation math marked with SIM_COST() (see src/SimCost.h). For exact
+  cycle counts run the nanoatmega328 firmware.elf under simavr.
+*/
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Arduino.h"
+
+void setup();
+void loop();
+
+int main(int argc, char** argv)
+{
+    unsigned long seconds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 3600;
+    uint32_t seed = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1;
+    if (argc > 3 && !simOpenTrace(argv[3]))
+    {
+        perror(argv[3]);
+        return 1;
+    }
+
+    simSeedNoise(seed);
+    setup();
+    simResetCounts();
+
+    uint64_t end = simMicrosNow + uint64_t(seconds) * 1000000;
+    auto started = std::chrono::steady_clock::now();
+    while (simMicrosNow < end)
+    {
+        loop();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    if (simFrames == 0)
+    {
+        return 1;
+    }
+
+    printf("simulated %lu s in %.2f s: %lu frames at %u Hz, %.0f ns per frame on the host\n",
+        seconds, elapsed.count(), simFrames, simFrameRate, elapsed.count() * 1e9 / simFrames);
+
+    printf("\n%-14s %12s %12s %14s\n", "call", "total", "per frame", "cycles/frame");
+    double cycles = 0;
+    for (int op = 0; op < simOpCount; ++op)
+    {
+        double perFrame = double(simOpCounts[op]) / simFrames;
+        double opCycles = perFrame * simOps[op].avrCycles;
+        cycles += opCycles;
+        printf("%-14s %12lu %12.3f %14.1f\n", simOps[op].name, simOpCounts[op], perFrame, opCycles);
+    }
+
+    if (simPoweredDownMicros)
+    {
+        printf("\npowered down for %.1f%% of the time\n", 100.0 * simPoweredDownMicros / (uint64_t(seconds) * 1000000));
+    }
+
+    double budget = 16e6 / simFrameRate;
+    printf("\nestimated cycles per frame: %.0f (%.2f%% of the %.0f-cycle frame budget)\n",
+        cycles, 100 * cycles / budget, budget);
+    printf("output checksum: %08x\n", simOutputHash);
+    return 0;
+}
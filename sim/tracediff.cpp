@@ -0,0 +1,245 @@
+/*
+  tracediff
+
+  Replays and compares output traces recorded with OUTPUT_TRACE (see
+  src/Trace.h), from the host simulator or dumped from the board.
+
+      tracediff a.trace
+          prints every event as "ms channel duty"
+      tracediff golden.trace new.trace [max error] [max drift]
+
+  Comparing, both traces are replayed side by side one ms at a time. For
+  each channel it reports the largest and mean difference in duty, and
+  how far apart in time (ms) the two traces make the same change: each
+  change in the golden trace is matched with the nearest change to the
+  same duty in the new one, within driftWindow ms. It exits with 1 if a
+  channel goes over either limit, which by default means any difference
+  at all.
+*/
+
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Trace.h"
+
+// The mock core's min() and max() macros would shadow std::min and std::max.
+#undef min
+#undef max
+
+const uint32_t driftWindow = 100;
+
+struct TraceEvent
+{
+    uint32_t time;
+    uint8_t channel;
+    uint8_t duty;
+};
+
+struct Trace
+{
+    std::vector<TraceEvent> events;
+    unsigned dropped = 0;
+    uint8_t channels = 0;
+};
+
+static bool load(const char* path, Trace& trace)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+
+    std::vector<uint8_t> bytes;
+    int c;
+    while ((c = fgetc(file)) != EOF)
+    {
+        bytes.push_back(c);
+    }
+    fclose(file);
+
+    uint32_t time = 0;
+    bool synced = false;
+    size_t i = 0;
+    while (i < bytes.size())
+    {
+        uint8_t head = bytes[i];
+        if (head == traceSync || head == traceDropped)
+        {
+            if (i + 3 > bytes.size())
+            {
+                break;
+            }
+            Tick tick = bytes[i + 1] | bytes[i + 2] << 8;
+            time = synced ? time + Tick(tick - Tick(time)) : tick;
+            synced = true;
+            trace.dropped += head == traceDropped;
+            i += 3;
+            continue;
+        }
+
+        if (!synced || head >> 4 == 15)
+        {
+            fprintf(stderr, "%s: bad record at byte %zu\n", path, i);
+            return false;
+        }
+        if (i + 2 > bytes.size())
+        {
+            break;
+        }
+        time += head & 15;
+        trace.events.push_back({time, uint8_t(head >> 4), bytes[i + 1]});
+        trace.channels = std::max(trace.channels, uint8_t((head >> 4) + 1));
+        i += 2;
+    }
+    return true;
+}
+
+static void print(const Trace& trace)
+{
+    for (const TraceEvent& event : trace.events)
+    {
+        printf("%u %u %u\n", event.time, event.channel, event.duty);
+    }
+    if (trace.dropped)
+    {
+        printf("dropped events at %u points\n", trace.dropped);
+    }
+}
+
+struct ChannelStats
+{
+    unsigned events[2] = {};
+    unsigned maxError = 0;
+    double totalError = 0;
+    unsigned maxDrift = 0;
+    double totalDrift = 0;
+    unsigned matched = 0;
+};
+
+static bool compare(const Trace& golden, const Trace& candidate, unsigned errorLimit, unsigned driftLimit)
+{
+    uint8_t channels = std::max(golden.channels, candidate.channels);
+    std::vector<ChannelStats> stats(channels);
+
+    // Duty error, replaying both traces a ms at a time.
+    std::vector<uint8_t> duty[2] = {std::vector<uint8_t>(channels), std::vector<uint8_t>(channels)};
+    const Trace* traces[2] = {&golden, &candidate};
+    size_t next[2] = {};
+    uint32_t start = UINT32_MAX;
+    uint32_t end = 0;
+    for (const Trace* trace : traces)
+    {
+        if (!trace->events.empty())
+        {
+            start = std::min(start, trace->events.front().time);
+            end = std::max(end, trace->events.back().time);
+        }
+    }
+
+    for (uint32_t t = start; start <= end && t <= end; ++t)
+    {
+        for (int n = 0; n < 2; ++n)
+        {
+            const std::vector<TraceEvent>& events = traces[n]->events;
+            while (next[n] < events.size() && events[next[n]].time <= t)
+            {
+                const TraceEvent& event = events[next[n]++];
+                duty[n][event.channel] = event.duty;
+                ++stats[event.channel].events[n];
+            }
+        }
+        for (uint8_t ch = 0; ch < channels; ++ch)
+        {
+            unsigned error = abs(duty[0][ch] - duty[1][ch]);
+            stats[ch].maxError = std::max(stats[ch].maxError, error);
+            stats[ch].totalError += error;
+        }
+    }
+
+    // Drift, matching each golden change with the nearest same change.
+    std::map<std::pair<uint8_t, uint8_t>, std::vector<uint32_t>> changes;
+    for (const TraceEvent& event : candidate.events)
+    {
+        changes[{event.channel, event.duty}].push_back(event.time);
+    }
+    for (const TraceEvent& event : golden.events)
+    {
+        auto found = changes.find({event.channel, event.duty});
+        if (found == changes.end())
+        {
+            continue;
+        }
+
+        const std::vector<uint32_t>& times = found->second;
+        auto after = std::lower_bound(times.begin(), times.end(), event.time);
+        uint32_t best = UINT32_MAX;
+        if (after != times.end())
+        {
+            best = *after - event.time;
+        }
+        if (after != times.begin())
+        {
+            best = std::min(best, event.time - *(after - 1));
+        }
+        if (best <= driftWindow)
+        {
+            ChannelStats& channel = stats[event.channel];
+            channel.maxDrift = std::max(channel.maxDrift, unsigned(best));
+            channel.totalDrift += best;
+            ++channel.matched;
+        }
+    }
+
+    double span = start <= end ? end - start + 1 : 1;
+    bool ok = true;
+    printf("%-3s %9s %9s %6s %8s %6s %8s %9s\n", "ch", "golden", "new", "error", "mean", "drift", "mean",
+        "unmatched");
+    for (uint8_t ch = 0; ch < channels; ++ch)
+    {
+        const ChannelStats& channel = stats[ch];
+        printf("%-3u %9u %9u %6u %8.3f %6u %8.3f %9u\n", ch, channel.events[0], channel.events[1],
+            channel.maxError, channel.totalError / span, channel.maxDrift,
+            channel.matched ? channel.totalDrift / channel.matched : 0.0, channel.events[0] - channel.matched);
+        ok = ok && channel.maxError <= errorLimit && channel.maxDrift <= driftLimit;
+    }
+
+    if (golden.dropped || candidate.dropped)
+    {
+        printf("dropped events: golden at %u points, new at %u\n", golden.dropped, candidate.dropped);
+    }
+    printf("%s\n", ok ? "match" : "MISMATCH");
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 5)
+    {
+        fprintf(stderr, "usage: %s trace | golden new [max error] [max drift]\n", argv[0]);
+        return 2;
+    }
+
+    Trace golden;
+    if (!load(argv[1], golden))
+    {
+        return 2;
+    }
+    if (argc == 2)
+    {
+        print(golden);
+        return 0;
+    }
+
+    Trace candidate;
+    if (!load(argv[2], candidate))
+    {
+        return 2;
+    }
+    unsigned errorLimit = argc > 3 ? strtoul(argv[3], nullptr, 10) : 0;
+    unsigned driftLimit = argc > 4 ? strtoul(argv[4], nullptr, 10) : 0;
+    return compare(golden, candidate, errorLimit, driftLimit) ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/*
+  AudioSampler
+
+  Sound level from an analog input, for driving LEDs from an audio
+  module without blocking the frame loop.
+
+  analogRead() waits out a whole conversion, about 110 us. Here the ADC
+  free-runs instead: left adjusted to 8 bits at a /128 prescaler, it
+  converts at 9.6 kHz and its interrupt only stores each sample in a ring
+  buffer. Once per frame level() drains the ring, strips the DC bias the
+  audio sits on, and runs a peak envelope follower with a fast attack
+  and a slow release, all in integer math.
+
+  The ring is sized for two frames of samples at FRAME_RATE_HZ, rounded
+  up to a power of two (64 bytes at 500 Hz, 256 at 100 Hz), so a frame
+  that overruns still finds all of them. Its 8-bit indices allow at most
+  256 bytes, so the frame rate has to be at least 76 Hz. If the ring does
+  fill up, the newest samples are dropped rather than overwriting unread
+  ones.
+
+  While the sampler runs, analogRead() must not be used. On the host
+  there is no ADC and level() stays 0.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "FrameScheduler.h"
+
+const uint16_t audioSampleRate = 9615;    // 16 MHz / 128 / 13 cycles
+
+// The smallest power of two from size up that is more than samples.
+constexpr uint16_t audioRingFor(uint16_t samples, uint16_t size = 16)
+{
+    return size > samples ? size : audioRingFor(samples, size * 2);
+}
+
+const uint16_t audioRingSize = audioRingFor(2 * audioSampleRate / FRAME_RATE_HZ);
+static_assert(audioRingSize <= 256, "the audio ring needs a FRAME_RATE_HZ of at least 76");
+
+#ifdef __AVR__
+
+uint8_t audioRing[audioRingSize];
+volatile uint8_t audioHead = 0;
+volatile uint8_t audioTail = 0;
+
+ISR(ADC_vect)
+{
+    uint8_t head = audioHead;
+    uint8_t next = (head + 1) & (audioRingSize - 1);
+    if (next != audioTail)
+    {
+        audioRing[head] = ADCH;
+        audioHead = next;
+    }
+}
+
+#endif
+
+class AudioSampler
+{
+    uint16_t bias = 0x8000;     // 8.8, starts mid-scale
+    uint16_t envelope = 0;      // 8.8
+
+  public:
+    // channel is the ADC input, 0..7 (A0..A7 on the Nano).
+    void begin(uint8_t channel)
+    {
+#ifdef __AVR__
+        ADMUX = _BV(REFS0) | _BV(ADLAR) | (channel & 0x07);
+        ADCSRB = 0;
+        if (channel < 6)
+        {
+            DIDR0 |= _BV(channel);
+        }
+        ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+#else
+        (void)channel;
+#endif
+    }
+
+    // Call once per frame. Returns the envelope, 0..255.
+    uint8_t level()
+    {
+        uint8_t peak = 0;
+#ifdef __AVR__
+        uint8_t head = audioHead;
+        uint8_t tail = audioTail;
+        while (tail != head)
+        {
+            uint8_t sample = audioRing[tail];
+            tail = (tail + 1) & (audioRingSize - 1);
+
+            // The bias follows the input at 1/256 per sample, a ~6 Hz
+            // high-pass, so the rumble itself isn't tracked out.
+            uint8_t mid = bias >> 8;
+            bias += int16_t(sample) - mid;
+            uint8_t swing = sample > mid ? sample - mid : mid - sample;
+            peak = max(peak, swing);
+        }
+        audioTail = tail;
+#endif
+
+        // Attack in a couple of frames, release over about sixteen.
+        uint16_t target = uint16_t(peak) << 8;
+        if (target > envelope)
+        {
+            envelope += (target - envelope) >> 1;
+        }
+        else
+        {
+            envelope -= (envelope - target) >> 4;
+        }
+
+        // A full-scale swing is half the ADC range.
+        return min(envelope >> 7, 255);
+    }
+};
@@ -0,0 +1,132 @@
+/*
+  ConfigStore
+
+  Keeps the newest copy of a small settings record in EEPROM.
+
+  EEPROM cells wear out after about 100k writes, so each save goes to the
+  next slot of a ring that fills the whole EEPROM, tagged with a sequence
+  number and a CRC. load() reads every slot once and keeps the valid one
+  with the highest sequence. A save that was cut short by a power loss
+  fails its CRC, so the previous record is used instead.
+
+  An EEPROM byte takes 3.3 ms to write, longer than a frame. save() only
+  queues the record, and service() writes one byte per call once the
+  previous byte has finished.
+
+  Record needs a static version number. The CRC covers it and the size of
+  the record, so records from a build with a different layout read as
+  missing. Bump the version when a change keeps the size the same.
+*/
+
+#pragma once
+#include <Arduino.h>
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#endif
+
+template <class Record>
+class ConfigStore
+{
+    struct Slot
+    {
+        uint16_t sequence;
+        Record record;
+        uint8_t check;
+    };
+
+    static const uint16_t fullRing = (E2END + 1) / sizeof(Slot);
+    static const uint8_t slotCount = fullRing > 255 ? 255 : fullRing;
+    static_assert(slotCount >= 2, "the record is too large for the EEPROM");
+
+    uint8_t current = slotCount - 1;    // slot last written, or being written
+    uint16_t sequence = 0;
+    Slot pending;
+    uint8_t written = sizeof(Slot);     // bytes of pending already written
+
+    static uint8_t* address(uint8_t slot)
+    {
+        return (uint8_t*)(uintptr_t)(slot * sizeof(Slot));
+    }
+
+    // CRC-8 (polynomial 0x07) step.
+    static uint8_t crc8(uint8_t crc, uint8_t byte)
+    {
+        crc ^= byte;
+        for (uint8_t bit = 0; bit < 8; ++bit)
+        {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+        return crc;
+    }
+
+    // CRC of the record's version and size, then everything before the
+    // check byte.
+    static uint8_t checksum(const Slot& slot)
+    {
+        const uint8_t* bytes = (const uint8_t*)&slot;
+        uint8_t crc = crc8(Record::version, sizeof(Record));
+        for (uint8_t i = 0; i < offsetof(Slot, check); ++i)
+        {
+            crc = crc8(crc, bytes[i]);
+        }
+        return crc;
+    }
+
+  public:
+    // Returns false, leaving record alone, if no slot holds a valid record.
+    bool load(Record& record)
+    {
+        bool found = false;
+        for (uint8_t i = 0; i < slotCount; ++i)
+        {
+            Slot slot;
+            eeprom_read_block(&slot, address(i), sizeof(slot));
+            if (slot.check != checksum(slot))
+            {
+                continue;
+            }
+
+            if (!found || int16_t(slot.sequence - sequence) > 0)
+            {
+                found = true;
+                current = i;
+                sequence = slot.sequence;
+                record = slot.record;
+            }
+        }
+        return found;
+    }
+
+    // A save during an unfinished write restarts it in the same slot, so
+    // the previous complete record stays intact.
+    void save(const Record& record)
+    {
+        if (written == sizeof(Slot))
+        {
+            current = current + 1 == slotCount ? 0 : current + 1;
+            ++sequence;
+        }
+
+        pending.sequence = sequence;
+        pending.record = record;
+        pending.check = checksum(pending);
+        written = 0;
+    }
+
+    // True when no write is in progress or queued.
+    bool idle() const
+    {
+        return written == sizeof(Slot) && eeprom_is_ready();
+    }
+
+    void service()
+    {
+        if (written == sizeof(Slot) || !eeprom_is_ready())
+        {
+            return;
+        }
+
+        eeprom_update_byte(address(current) + written, ((const uint8_t*)&pending)[written]);
+        ++written;
+    }
+};
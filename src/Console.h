@@ -0,0 +1,125 @@
+/*
+  Console
+
+  Line-based command reader for tuning the show over Serial without
+  reflashing. A command is a letter followed by up to consoleMaxArgs
+  integers separated by spaces or commas, ended by CR or LF, e.g.
+  "w 3 2000 58 110".
+
+  The Serial RX interrupt already queues incoming bytes in the core's ring
+  buffer; poll() takes at most consoleBytesPerPoll of them per call, so a
+  burst of input never stretches a frame. What the letters mean is up to
+  the sketch.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+const uint8_t consoleLineLength = 32;
+const uint8_t consoleBytesPerPoll = 8;
+const uint8_t consoleMaxArgs = 5;
+
+struct ConsoleCommand
+{
+    char op;
+    uint8_t argCount;
+    int16_t args[consoleMaxArgs];
+};
+
+class Console
+{
+    char line[consoleLineLength];
+    uint8_t length = 0;
+    bool overflow = false;
+
+    bool parse(ConsoleCommand& command)
+    {
+        uint8_t i = 0;
+        while (i < length && line[i] == ' ')
+        {
+            ++i;
+        }
+        if (i == length)
+        {
+            return false;
+        }
+
+        command.op = line[i++];
+        command.argCount = 0;
+        while (true)
+        {
+            while (i < length && (line[i] == ' ' || line[i] == ','))
+            {
+                ++i;
+            }
+            if (i == length)
+            {
+                return true;
+            }
+            if (command.argCount == consoleMaxArgs)
+            {
+                return false;
+            }
+
+            bool negative = line[i] == '-';
+            if (negative)
+            {
+                ++i;
+            }
+            if (i == length || line[i] < '0' || line[i] > '9')
+            {
+                return false;
+            }
+
+            int16_t value = 0;
+            while (i < length && line[i] >= '0' && line[i] <= '9')
+            {
+                value = value * 10 + (line[i++] - '0');
+            }
+            command.args[command.argCount++] = negative ? -value : value;
+        }
+    }
+
+  public:
+    // Returns true once a complete command has arrived. Lines that don't
+    // parse are answered with '?' and dropped.
+    bool poll(ConsoleCommand& command)
+    {
+        for (uint8_t n = 0; n < consoleBytesPerPoll; ++n)
+        {
+            int c = Serial.read();
+            if (c < 0)
+            {
+                break;
+            }
+
+            if (c != '\r' && c != '\n')
+            {
+                if (length < consoleLineLength)
+                {
+                    line[length++] = c;
+                }
+                else
+                {
+                    overflow = true;
+                }
+                continue;
+            }
+
+            if (length == 0 && !overflow)
+            {
+                continue;
+            }
+
+            bool ok = !overflow && parse(command);
+            length = 0;
+            overflow = false;
+            if (ok)
+            {
+                return true;
+            }
+            Serial.println('?');
+        }
+        return false;
+    }
+};
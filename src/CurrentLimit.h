@@ -0,0 +1,97 @@
+/*
+  CurrentLimit
+
+  Output stage that keeps the LEDs' total current under a budget, for
+  battery packs and regulators that can't take every LED at full at once.
+  It wraps another output backend and takes the same calls.
+
+  Each channel has a rating, its current in mA at full duty. write() keeps
+  a running sum of duty times rating, so it costs two small multiplies
+  whatever the channel count. When commit() finds the sum over the budget,
+  every channel is scaled by the same factor, so the show keeps its
+  balance and only dims as a whole. Working out a new factor takes one
+  32-bit division, and only happens in frames that are over the budget
+  and changed something.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "SimCost.h"
+
+template <uint8_t N, class Output>
+class CurrentLimit
+{
+    Output output;
+    uint16_t value[N];
+    uint8_t rating[N];
+    uint32_t draw = 0;          // sum of 8-bit duty * rating
+    uint32_t budget = 0xffffffffUL;
+    uint16_t scale = 256;       // per 256
+    bool changed = false;
+
+    static uint16_t weight(uint16_t v, uint8_t mA)
+    {
+        SIM_COST(simOpMul8);
+        return (v >> 8) * mA;
+    }
+
+  public:
+    void attach(uint8_t ch, uint8_t pn)
+    {
+        value[ch] = 0;
+        rating[ch] = 0;
+        output.attach(ch, pn);
+    }
+
+    // Unrated channels don't count towards the budget but are still dimmed.
+    void setRating(uint8_t ch, uint8_t mA)
+    {
+        draw -= weight(value[ch], rating[ch]);
+        rating[ch] = mA;
+        draw += weight(value[ch], mA);
+        changed = true;
+    }
+
+    void setBudget(uint16_t mA)
+    {
+        budget = uint32_t(mA) * 255;
+        changed = true;
+    }
+
+    // Whether the outputs are being dimmed below what was written.
+    bool limiting() const
+    {
+        return scale < 256;
+    }
+
+    void write(uint8_t ch, uint16_t v)
+    {
+        draw += weight(v, rating[ch]) - weight(value[ch], rating[ch]);
+        value[ch] = v;
+        changed = true;
+        if (scale == 256)
+        {
+            output.write(ch, v);
+        }
+    }
+
+    void commit()
+    {
+        if (changed)
+        {
+            changed = false;
+            SIM_COST(simOpDivide);
+            uint16_t fit = draw > budget ? (budget << 8) / draw : 256;
+            if (fit != scale || fit < 256)
+            {
+                scale = fit;
+                for (uint8_t ch = 0; ch < N; ++ch)
+                {
+                    SIM_COST(simOpMul16);
+                    output.write(ch, (uint32_t(value[ch]) * scale) >> 8);
+                }
+            }
+        }
+        output.commit();
+    }
+};
@@ -0,0 +1,131 @@
+/*
+  EventQueue
+
+  Fixed-capacity min-heap of pending (tick, id) events, so a frame only
+  touches the events that are due instead of checking everything that is
+  waiting. Push and pop are O(log n); remove() is O(n) and meant for the
+  rare cancellation.
+
+  Ticks are compared as wrapping differences, so every pending event has
+  to be less than 32.7 s ahead.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "SimCost.h"
+#include "Tick.h"
+
+template <uint8_t Capacity>
+class EventQueue
+{
+    Tick at[Capacity];
+    uint8_t id[Capacity];
+    uint8_t count = 0;
+
+    static bool before(Tick a, Tick b)
+    {
+        return int16_t(a - b) < 0;
+    }
+
+    void swap(uint8_t i, uint8_t j)
+    {
+        SIM_COST(simOpHeapSwap);
+        Tick t = at[i];
+        at[i] = at[j];
+        at[j] = t;
+        uint8_t e = id[i];
+        id[i] = id[j];
+        id[j] = e;
+    }
+
+    void siftUp(uint8_t i)
+    {
+        while (i > 0)
+        {
+            uint8_t parent = (i - 1) / 2;
+            if (!before(at[i], at[parent]))
+            {
+                break;
+            }
+            swap(i, parent);
+            i = parent;
+        }
+    }
+
+    void siftDown(uint8_t i)
+    {
+        while (true)
+        {
+            uint8_t least = i;
+            uint8_t child = 2 * i + 1;
+            if (child < count && before(at[child], at[least]))
+            {
+                least = child;
+            }
+            if (child + 1 < count && before(at[child + 1], at[least]))
+            {
+                least = child + 1;
+            }
+            if (least == i)
+            {
+                break;
+            }
+            swap(i, least);
+            i = least;
+        }
+    }
+
+    void removeAt(uint8_t i)
+    {
+        --count;
+        if (i == count)
+        {
+            return;
+        }
+        at[i] = at[count];
+        id[i] = id[count];
+        siftDown(i);
+        siftUp(i);
+    }
+
+  public:
+    // Returns false if the queue is full.
+    bool push(Tick when, uint8_t event)
+    {
+        SIM_COST(simOpQueue);
+        if (count == Capacity)
+        {
+            return false;
+        }
+        at[count] = when;
+        id[count] = event;
+        siftUp(count++);
+        return true;
+    }
+
+    // Takes the earliest event if it is due at now.
+    bool popDue(Tick now, uint8_t& event)
+    {
+        SIM_COST(simOpQueue);
+        if (count == 0 || before(now, at[0]))
+        {
+            return false;
+        }
+        event = id[0];
+        removeAt(0);
+        return true;
+    }
+
+    void remove(uint8_t event)
+    {
+        SIM_COST(simOpQueue);
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            if (id[i] == event)
+            {
+                removeAt(i);
+                return;
+            }
+        }
+    }
+};
@@ -8,7 +8,49 @@
 */
 
 // #define DEBUG_OUTPUT
+// #define PROFILE_FRAMES    // time each frame stage; send 'p' over Serial for a report
+// #define FLOAT_WAVEFORM    // evaluate sinusoids with cos() instead of the table
+#define FRAME_RATE_HZ 200    // frames per second, e.g. 100, 200 or 500
+// #define ANALOGWRITE_OUTPUT    // drive the LEDs through analogWrite()
+// #define SOFT_PWM    // BAM on Timer2 for the turret, hold and beacon LEDs
+// #define HIRES_PWM    // 12-bit Timer1 on pins 9/10, dithering on the other PWM pins
+// #define SERIAL_CONSOLE    // live control over Serial, see runConsoleCommand()
+// #define AUDIO_ENGINE    // in flight, the engine follows a sound level on A7
+// #define SYNC_MASTER    // send the clock and show state to other boards on Serial TX
+// #define SYNC_FOLLOWER    // run on the clock and show state heard on Serial RX
+// #define DEEP_SLEEP    // power down while every LED is fully off or on
+// #define CURRENT_BUDGET    // dim everything together past currentBudget mA
+// #define MEMORY_REPORT    // send 'm' over Serial for SRAM use and stack headroom
+// #define OUTPUT_TRACE    // stream every LED duty change over Serial, see Trace.h
 #include <Arduino.h>
+#ifdef AUDIO_ENGINE
+#include "AudioSampler.h"
+#endif
+#include "ConfigStore.h"
+#include "Console.h"
+#include "CurrentLimit.h"
+#include "FrameScheduler.h"
+#include "LedBank.h"
+#include "LedGroup.h"
+#include "MemoryProfile.h"
+#include "Profiler.h"
+#include "Random.h"
+#include "Show.h"
+#include "Sync.h"
+#include "Tick.h"
+#include "Trace.h"
+
+#if defined(SYNC_FOLLOWER) && (defined(SERIAL_CONSOLE) || defined(PROFILE_FRAMES) || defined(MEMORY_REPORT) || defined(SYNC_MASTER))
+#error "SYNC_FOLLOWER needs Serial RX to itself"
+#endif
+
+#if defined(DEEP_SLEEP) && (defined(SERIAL_CONSOLE) || defined(PROFILE_FRAMES) || defined(MEMORY_REPORT) || defined(SYNC_MASTER) || defined(SYNC_FOLLOWER))
+#error "DEEP_SLEEP stops the clock the Serial port runs on"
+#endif
+
+#if defined(OUTPUT_TRACE) && (defined(SERIAL_CONSOLE) || defined(PROFILE_FRAMES) || defined(MEMORY_REPORT) || defined(SYNC_MASTER) || defined(DEEP_SLEEP))
+#error "OUTPUT_TRACE needs Serial TX to itself"
+#endif
 
 unsigned long generateRandomSeed()
 {
@@ -21,152 +63,6 @@ unsigned long generateRandomSeed()
     return seed;
 }
 
-class Led
-{
-    enum class LedMode
-    {
-        on,
-        off,
-        ramp,
-        sinusoid,
-        flicker
-    };
-
-    int pin;
-    int period = 1000;
-    int phase = 0;
-    int delay = 0;
-    LedMode mode = LedMode::sinusoid;
-
-    int minBright = 0;
-    int maxBright = 255;
-
-    unsigned long startTime = 0;
-    int lastValue = 0;
-
-  public:
-    Led(int pn)
-        : pin(pn)
-    {
-    }
-
-    void init()
-    {
-        pinMode(pin, OUTPUT);
-        analogWrite(pin, 255);
-        ::delay(250);
-        analogWrite(pin, 0);
-        startTime = millis();
-    }
-
-    void update(unsigned long now)
-    {
-        int delta = now - startTime - delay;
-        if (delta < 0)
-        {
-            return;
-        }
-
-        int value;
-        switch (mode)
-        {
-            case LedMode::off:
-                value = 0;
-                break;
-
-            case LedMode::on:
-                value = maxBright;
-                break;
-
-            case LedMode::ramp:
-            {
-                auto v = 1.0 * min(period, delta) / period;
-                value = minBright + int((maxBright - minBright) * v);
-                break;
-            }
-
-            case LedMode::sinusoid:
-            {
-                auto t = 1.0 * ((delta + phase) % period) / (period - 1);
-                auto v = (cos(2 * M_PI * (t - 0.5)) + 1) / 2;
-                value = minBright + int((maxBright - minBright) * v);
-                break;
-            }
-
-            case LedMode::flicker:
-            {
-                value = lastValue;
-                if (delta % 29 == 0)
-                {
-                    value = random(minBright, maxBright);
-                }
-            }
-        }
-
-        auto p2 = period / 2.0;
-        auto factor = (p2 - delta) / p2;
-        if (factor > 0)
-        {
-            int v = (factor * lastValue) + (1.0 - factor) * value;
-            value = v;
-        }
-
-        if (value != lastValue)
-        {
-            analogWrite(pin, value);
-        }
-
-        lastValue = value;
-    }
-
-    void off()
-    {
-        mode = LedMode::off;
-        startTime = millis();
-        lastValue = 0;
-        analogWrite(pin, lastValue);
-    }
-
-    void on(int mx)
-    {
-        mode = LedMode::on;
-        maxBright = mx;
-        lastValue = mx;
-        startTime = millis();
-        analogWrite(pin, lastValue);
-    }
-
-    void rampTo(int mx, int pd, int d=0)
-    {
-        mode = LedMode::ramp;
-        minBright = lastValue;
-        maxBright = mx;
-        period = pd;
-        delay = d;
-        startTime = millis();
-        update(millis());
-    }
-
-    void startSinusoid(int pd, int mn, int mx, int ph = 0)
-    {
-        mode = LedMode::sinusoid;
-        minBright = mn;
-        maxBright = mx;
-        period = pd;
-        phase = ph;
-        startTime = millis();
-        update(millis());
-    }
-
-    void startFlicker(int mn, int mx, int d)
-    {
-        mode = LedMode::flicker;
-        minBright = mn;
-        maxBright = mx;
-        delay = d;
-    }
-};
-
 enum class EngineState
 {
     off,
@@ -176,30 +72,101 @@ enum class EngineState
     failing,
     rampingUp,
     rampingDown,
-    landing
+    landing,
+    audio
+};
+
+enum LedChannel : uint8_t
+{
+    cockpitLed,
+    headlightsLed,
+    landingLightsLed,
+    engineLed1,
+    engineLed2,
+    engineLed3,
+#ifdef SOFT_PWM
+    turretsLed,
+    holdLed,
+    navBeaconLed,
+#endif
+    ledCount
+};
+
+#ifdef SOFT_PWM
+using FalconPwm = PwmOutput<ledCount>;
+#else
+// Pins in channel order, matching the leds.init() calls.
+using FalconPwm = PinPwmOutput<3, 5, 6, 9, 10, 11>;
+#endif
+
+#ifdef CURRENT_BUDGET
+using FalconOutput = CurrentLimit<ledCount, FalconPwm>;
+
+// mA at full duty per LED, and what the supply can spare for all of them.
+const uint8_t ledRating[ledCount] = {
+    20,    // cockpit
+    40,    // headlights
+    40,    // landing lights
+    30,    // engine
+    30,
+    30,
+#ifdef SOFT_PWM
+    20,    // turrets
+    20,    // hold
+    20,    // nav beacon
+#endif
+};
+const uint16_t currentBudget = 150;
+#else
+using FalconOutput = FalconPwm;
+#endif
+
+#ifdef OUTPUT_TRACE
+using FalconLeds = LedBank<ledCount, TraceOutput<ledCount, FalconOutput>>;
+#else
+using FalconLeds = LedBank<ledCount, FalconOutput>;
+#endif
+
+const uint8_t audioChannel = 7;    // ADC input of the sound module
+
+// Catch, falter, then spool up to full power.
+const Keyframe engineSpoolUp[] PROGMEM = {
+    {400, 140, Curve::ease},
+    {300, 96, Curve::ease},
+    {1300, 180, Curve::linear},
+    {4000, 238, Curve::ease}
+};
+
+// {min, max} per thruster while following the sound level.
+const uint8_t engineAudioRanges[3][2] = {
+    {110, 255},
+    {80, 230},
+    {130, 255}
 };
 
 class Engine
 {
     EngineState engineState = EngineState::idling;
 
-    Led led1;
-    Led led2;
-    Led led3;
+    FalconLeds& leds;
+    LedGroup<FalconLeds> thrusters;
 
   public:
-    Engine()
-        : led1(9)
-        , led2(10)
-        , led3(11)
+    Engine(FalconLeds& bank)
+        : leds(bank), thrusters(bank, engineLed1, 3)
     {
     }
 
     void setup()
     {
-        led1.init();
-        led2.init();
-        led3.init();
+        leds.init(engineLed1, 9);
+        leds.init(engineLed2, 10);
+        leds.init(engineLed3, 11);
+
+        // The engine levels below are perceptual.
+        leds.setGamma(engineLed1, true);
+        leds.setGamma(engineLed2, true);
+        leds.setGamma(engineLed3, true);
     }
 
     void newState(EngineState state)
@@ -209,69 +176,63 @@ class Engine
         {
             case EngineState::off:
             {
-                led1.off();
-                led2.off();
-                led3.off();
+                thrusters.off();
                 break;
             }
 
             case EngineState::idling:
             {
-                const int period = 2000;
-                led1.startSinusoid(period, 10, 40);
-                led2.startSinusoid(period, 10, 40, period / 3);
-                led3.startSinusoid(period, 10, 40, -period / 3);
+                thrusters.startSinusoid(2000, 58, 110);
                 break;
             }
 
             case EngineState::fullPower:
             {
-                const int period = 60;
-                led1.startSinusoid(period, 200, 255);
-                led2.startSinusoid(period, 200, 255, period / 3);
-                led3.startSinusoid(period, 200, 255, -period / 3);
+                thrusters.startSinusoid(60, 228, 255);
                 break;
             }
 
             case EngineState::failing:
             {
-                led1.startFlicker(64, 128, 0);
-                led2.startFlicker(0, 64, 0);
-                led3.startSinusoid(1000, 64, 170, 0);
+                leds.startFlicker(engineLed1, 136, 186, 0);
+                leds.startFlicker(engineLed2, 0, 136, 0);
+                leds.startSinusoid(engineLed3, 1000, 136, 212, 0);
                 break;
             }
 
             case EngineState::rampingUp:
             {
-                led1.rampTo(220, 6000);
-                led2.rampTo(220, 6000);
-                led3.rampTo(220, 6000);
+                thrusters.startEnvelope(engineSpoolUp);
                 break;
             }
 
             case EngineState::rampingDown:
             {
-                led1.rampTo(0, 2000);
-                led2.rampTo(0, 2000);
-                led3.rampTo(0, 2000);
+                thrusters.rampTo(0, 2000);
                 break;
             }
 
             case EngineState::landing:
             {
-                led1.rampTo(25, 4000);
-                led2.rampTo(25, 4000);
-                led3.rampTo(25, 4000);
+                thrusters.rampTo(88, 4000);
+                break;
+            }
+
+            case EngineState::audio:
+            {
+                thrusters.startExternal(engineAudioRanges);
                 break;
             }
         }
     }
 
-    void loop(unsigned int now)
+    // Call every frame; only the audio state uses it.
+    void setInput(uint8_t level)
     {
-        led1.update(now);
-        led2.update(now);
-        led3.update(now);
+        if (engineState == EngineState::audio)
+        {
+            leds.setInput(engineLed1, level);
+        }
     }
 };
 
@@ -284,160 +245,633 @@ enum FalconState
     EmergencyShutdown,
     Restarting,
     InFlight,
-    Landing
+    Landing,
+    RestartedOnGround    // OnGround after a failed start, which can't fail again
 };
 
+const uint8_t falconStateCount = FalconState::RestartedOnGround + 1;
+
+
+// Saved on console changes, and on show state changes at most once per
+// stateSaveInterval.
+struct FalconConfig
+{
+    static const uint8_t version = 1;
+
+    uint16_t randomState;
+    uint8_t state;              // show state to resume in after a power cut
+    bool resume;
+    uint8_t limit[ledCount];    // brightness limit per LED
+};
+
+const uint16_t stateSaveInterval = 60000;    // ms
 
 struct NextState
 {
-    long timeToSwitch;
+    uint16_t timeToSwitch;
     FalconState next;
 };
 
-Engine engine;
-Led cockpit(3);
-Led headlights(5);
-Led landingLights(6);
-unsigned stateStartTime;
+FrameScheduler scheduler;
+Profiler profiler;
+FastRandom showRandom;
+FalconLeds leds;
+Engine engine(leds);
+Tick stateStartTime;
 FalconState falconState = FalconState::OnGround;
 NextState nextState;
-bool lastStartFailed = false;
+ConfigStore<FalconConfig> configStore;
+FalconConfig config;
+bool stateUnsaved = false;
+Tick lastStateSave;
+#ifdef AUDIO_ENGINE
+AudioSampler audio;
+#endif
+#if defined(SYNC_MASTER) || defined(SYNC_FOLLOWER)
+SyncLink sync;
+#endif
+
+#ifdef OUTPUT_TRACE
+FalconOutput& output()
+{
+    return leds.outputStage().inner();
+}
+#else
+FalconOutput& output()
+{
+    return leds.outputStage();
+}
+#endif
+#ifdef SERIAL_CONSOLE
+Console console;
+bool holdState = false;
+Tick heldAt;    // time into the show state when it was held
+#else
+const bool holdState = false;
+#endif
+
+const ShowCommand onGroundCommands[] PROGMEM = {
+    showRamp(cockpitLed, 255, 250),
+    showRamp(headlightsLed, 0, 1000),
+    showRamp(landingLightsLed, 255, 1000, 1000),
+    showEngine(EngineState::idling)
+};
+const ShowTransition onGroundNext[] PROGMEM = {
+    {1, FalconState::FailingStart, 5000, 20000},
+    {3, FalconState::PrepareForFlight, 5000, 20000}
+};
+
+// Two failed starts never come back to back.
+const ShowTransition restartedOnGroundNext[] PROGMEM = {
+    {1, FalconState::PrepareForFlight, 5000, 20000}
+};
+
+const ShowCommand prepareForFlightCommands[] PROGMEM = {
+    showRamp(cockpitLed, 64, 3000, 2000),
+    showRamp(headlightsLed, 255, 500, 1400),
+    showRamp(landingLightsLed, 0, 1500),
+    showEngine(EngineState::rampingUp)
+};
+const ShowTransition prepareForFlightNext[] PROGMEM = {
+    {1, FalconState::InFlight, 6000, 6000}
+};
+
+const ShowCommand failingStartCommands[] PROGMEM = {
+    showRamp(cockpitLed, 64, 3000, 2000),
+    showRamp(headlightsLed, 255, 500, 1400),
+    showRamp(landingLightsLed, 0, 1500),
+    showEngine(EngineState::rampingUp)
+};
+const ShowTransition failingStartNext[] PROGMEM = {
+    {1, FalconState::Failing, 2000, 4000}
+};
+
+const ShowCommand failingCommands[] PROGMEM = {
+    showFlicker(cockpitLed, 0, 128, 100, 1400),
+    showFlicker(headlightsLed, 0, 32, 1000, 1000),
+    showFlicker(landingLightsLed, 32, 128, 100, 1900),
+    showEngine(EngineState::failing)
+};
+const ShowTransition failingNext[] PROGMEM = {
+    {1, FalconState::EmergencyShutdown, 1000, 2000}
+};
+
+const ShowCommand emergencyShutdownCommands[] PROGMEM = {
+    showRamp(headlightsLed, 0, 750),
+    showRamp(cockpitLed, 0, 250, 750),
+    showRamp(landingLightsLed, 0, 500),
+    showEngine(EngineState::rampingDown)
+};
+const ShowTransition emergencyShutdownNext[] PROGMEM = {
+    {1, FalconState::Restarting, 5000, 5000}
+};
+
+const ShowCommand restartingCommands[] PROGMEM = {
+    showOff(headlightsLed),
+    showRamp(cockpitLed, 255, 750),
+    showRamp(landingLightsLed, 255, 1500, 2000),
+    showEngine(EngineState::off)
+};
+const ShowTransition restartingNext[] PROGMEM = {
+    {1, FalconState::RestartedOnGround, 4000, 4000}
+};
+
+const ShowCommand inFlightCommands[] PROGMEM = {
+    showRamp(cockpitLed, 64, 250),
+    showRamp(headlightsLed, 255, 500),
+    showRamp(landingLightsLed, 0, 500),
+#ifdef AUDIO_ENGINE
+    showEngine(EngineState::audio)
+#else
+    showEngine(EngineState::fullPower)
+#endif
+};
+const ShowTransition inFlightNext[] PROGMEM = {
+    {1, FalconState::Landing, 10000, 20000}
+};
+
+const ShowCommand landingCommands[] PROGMEM = {
+    showRamp(cockpitLed, 200, 500),
+    showRamp(landingLightsLed, 255, 1500, 1500),
+    showRamp(headlightsLed, 0, 2000, 1500),
+    showEngine(EngineState::landing)
+};
+const ShowTransition landingNext[] PROGMEM = {
+    {1, FalconState::OnGround, 4000, 4000}
+};
+
+// Indexed by FalconState.
+const ShowState show[] PROGMEM = {
+    showState(onGroundCommands, onGroundNext),
+    showState(prepareForFlightCommands, prepareForFlightNext),
+    showState(failingStartCommands, failingStartNext),
+    showState(failingCommands, failingNext),
+    showState(emergencyShutdownCommands, emergencyShutdownNext),
+    showState(restartingCommands, restartingNext),
+    showState(inFlightCommands, inFlightNext),
+    showState(landingCommands, landingNext),
+    showState(onGroundCommands, restartedOnGroundNext)
+};
+
+static_assert(sizeof(show) / sizeof(show[0]) == falconStateCount,
+    "show table needs one entry per FalconState");
+
+void runShowCommand(const ShowCommand& command)
+{
+    if (command.op == ShowOp::engine)
+    {
+        engine.newState(EngineState(command.level));
+        return;
+    }
+
+    uint8_t ch = command.light;
+    int offset = command.offset + showRandom.below(command.jitter);
+    switch (command.op)
+    {
+        case ShowOp::off:
+            leds.off(ch);
+            break;
+
+        case ShowOp::on:
+            leds.on(ch, command.level);
+            break;
+
+        case ShowOp::ramp:
+            leds.rampTo(ch, command.level, command.period, offset);
+            break;
+
+        case ShowOp::sinusoid:
+            leds.startSinusoid(ch, command.period, command.minLevel, command.level, offset);
+            break;
+
+        case ShowOp::flicker:
+        case ShowOp::pinkFlicker:
+            leds.startFlicker(ch, command.minLevel, command.level, offset, command.period & 0xff,
+                command.period >> 8, command.op == ShowOp::pinkFlicker);
+            break;
+
+        case ShowOp::engine:
+            break;
+    }
+}
+
+void saveConfig()
+{
+    stateUnsaved = false;
+    configStore.save(config);
+}
+
+// A power cut resumes in the last saved state, replaying it from the
+// show random state it was entered with.
+void saveShowState(Tick now)
+{
+    if (Tick(now - lastStateSave) < stateSaveInterval)
+    {
+        return;
+    }
+
+    if (stateUnsaved)
+    {
+        saveConfig();
+        lastStateSave = now;
+    }
+    else
+    {
+        lastStateSave = now - stateSaveInterval;    // so the difference can't wrap
+    }
+}
 
 NextState nextFalconState(FalconState state)
 {
     falconState = state;
-    switch (state)
+    if (state != config.state)
     {
-        case FalconState::OnGround:
-        {
-            cockpit.rampTo(255, 250);
-            headlights.rampTo(0, 1000);
-            landingLights.rampTo(255, 1000, 1000);
-            engine.newState(EngineState::idling);
-            lastStartFailed = !lastStartFailed && random(1024%4) == 0;
-            return {
-                random(5000, 20000),
-                lastStartFailed ? FalconState::FailingStart : FalconState::PrepareForFlight
-            };
-        }
+        config.state = state;
+        config.randomState = showRandom.saveState();
+        stateUnsaved = true;
+    }
+#ifdef SYNC_MASTER
+    sync.sendState(state, showRandom.saveState());
+#endif
 
-        case FalconState::PrepareForFlight:
-        {
-            cockpit.rampTo(64, 3000, 2000);
-            headlights.rampTo(255, 500, 1400);
-            landingLights.rampTo(0, 1500);
-            engine.newState(EngineState::rampingUp);
-            return {
-                6000,
-                FalconState::InFlight
-            };
-        }
+    ShowState entry;
+    memcpy_P(&entry, &show[state], sizeof(entry));
 
-        case FalconState::FailingStart:
-        {
-            cockpit.rampTo(64, 3000, 2000);
-            headlights.rampTo(255, 500, 1400);
-            landingLights.rampTo(0, 1500);
-            engine.newState(EngineState::rampingUp);
-            return {
-                random(2000, 4000),
-                FalconState::Failing
-            };
-        }
+    for (uint8_t i = 0; i < entry.commandCount; ++i)
+    {
+        ShowCommand command;
+        memcpy_P(&command, &entry.commands[i], sizeof(command));
+        runShowCommand(command);
+    }
 
-        case FalconState::Failing:
-        {
-            cockpit.startFlicker(0, 128, random(100, 1500));
-            headlights.startFlicker(0, 32, random(1000, 2000));
-            landingLights.startFlicker(32, 128, random(100, 2000));
-            engine.newState(EngineState::failing);
-            return {
-                random(1000, 2000),
-                FalconState::EmergencyShutdown
-            };
-        }
+    int totalWeight = 0;
+    for (uint8_t i = 0; i < entry.transitionCount; ++i)
+    {
+        totalWeight += pgm_read_byte(&entry.transitions[i].weight);
+    }
 
-        case FalconState::EmergencyShutdown:
+    int pick = showRandom.below(totalWeight);
+    for (uint8_t i = 0; i < entry.transitionCount; ++i)
+    {
+        ShowTransition transition;
+        memcpy_P(&transition, &entry.transitions[i], sizeof(transition));
+        if (pick < transition.weight)
         {
-            headlights.rampTo(0, 750);
-            cockpit.rampTo(0, 250, 750);
-            landingLights.rampTo(0, 500);
-            engine.newState(EngineState::rampingDown);
             return {
-                5000,
-                FalconState::Restarting
+                showRandom.range(transition.minDuration, transition.maxDuration),
+                FalconState(transition.next)
             };
         }
+        pick -= transition.weight;
+    }
 
-        case FalconState::Restarting:
-        {
-            headlights.off();
-            cockpit.rampTo(255, 750);
-            landingLights.rampTo(255, 1500, 2000);
-            engine.newState(EngineState::off);
-            return {
-                4000,
-                FalconState::OnGround
-            };
-        }
+    return {5000, FalconState::OnGround};
+}
 
-        case FalconState::InFlight:
-        {
-            cockpit.rampTo(64, 250);
-            headlights.rampTo(255, 500);
-            landingLights.rampTo(0, 500);
-            engine.newState(EngineState::fullPower);
-            return {
-                random(10000, 20000),
-                FalconState::Landing
-            };
-        }
+#ifdef MEMORY_REPORT
+// Bytes of SRAM per part of the sketch, then all static data and the
+// stack headroom left since boot.
+void reportMemory()
+{
+    memoryLine(F("leds"), sizeof(leds));
+    memoryLine(F("engine"), sizeof(engine));
+    memoryLine(F("show"), sizeof(showRandom) + sizeof(stateStartTime) + sizeof(falconState) + sizeof(nextState));
+    memoryLine(F("config"), sizeof(configStore) + sizeof(config) + sizeof(stateUnsaved) + sizeof(lastStateSave));
+    memoryLine(F("frame"), sizeof(scheduler) + sizeof(profiler));
+#ifdef SOFT_PWM
+    memoryLine(F("softpwm"), sizeof(softPwm));
+#endif
+#ifdef AUDIO_ENGINE
+    memoryLine(F("audio"), sizeof(audio) + audioRingSize);
+#endif
+#if defined(SYNC_MASTER) || defined(SYNC_FOLLOWER)
+    memoryLine(F("sync"), sizeof(sync));
+#endif
+#ifdef SERIAL_CONSOLE
+    memoryLine(F("console"), sizeof(console));
+#endif
+    memoryLine(F("serial"), sizeof(Serial));
+    memoryLine(F("static"), staticRam());
+    memoryLine(F("headroom"), stackHeadroom());
+}
+#endif
+
+#ifdef SERIAL_CONSOLE
+// s state          jump to a show state
+// h                hold the current show state, or release it
+// e state          set the EngineState
+// f light          LED off
+// o light level    LED on
+// r light level period [delay]
+// w light period min max [phase]
+// k light min max [mean jitter]
+// l light level    set and save an LED's brightness limit
+// u 0|1            save whether to resume the show state after a power cut
+// t                show state, time in it and time it ends
+// p                frame profile (PROFILE_FRAMES)
+// m                memory report (MEMORY_REPORT)
+//
+// Levels are 0..255, periods and delays 0..32767 ms, a flicker mean
+// 1..255 ms and its jitter 0..255 ms. Anything out of range gets '?'.
+bool within(int16_t value, int16_t lo, int16_t hi)
+{
+    return value >= lo && value <= hi;
+}
 
-        case FalconState::Landing:
+void runConsoleCommand(const ConsoleCommand& command, Tick now)
+{
+    const int16_t* arg = command.args;
+    uint8_t argCount = command.argCount;
+    bool ok = true;
+    if (strchr("forwkl", command.op) && (argCount == 0 || uint16_t(arg[0]) >= ledCount))
+    {
+        ok = false;
+    }
+    else
+    {
+        switch (command.op)
         {
-            cockpit.rampTo(200, 500);
-            landingLights.rampTo(255, 1500, 1500);
-            headlights.rampTo(0, 2000, 1500);
-            engine.newState(EngineState::landing);
-            return {
-                4000,
-                FalconState::OnGround
-            };
+            case 's':
+                ok = argCount == 1 && uint16_t(arg[0]) < falconStateCount;
+                if (ok)
+                {
+                    stateStartTime = now;
+                    heldAt = 0;
+                    nextState = nextFalconState(FalconState(arg[0]));
+                }
+                break;
+
+            case 'h':
+                // The time in the state stands still while it is held, so
+                // a hold of any length can't wrap it.
+                if (holdState)
+                {
+                    stateStartTime = now - heldAt;
+                }
+                else
+                {
+                    heldAt = now - stateStartTime;
+                }
+                holdState = !holdState;
+                break;
+
+            case 'e':
+                ok = argCount == 1 && uint16_t(arg[0]) <= uint8_t(EngineState::audio);
+                if (ok)
+                {
+                    engine.newState(EngineState(arg[0]));
+                }
+                break;
+
+            case 'f':
+                runShowCommand(showOff(arg[0]));
+                break;
+
+            case 'o':
+                ok = argCount == 2 && within(arg[1], 0, 255);
+                if (ok)
+                {
+                    runShowCommand(showOn(arg[0], arg[1]));
+                }
+                break;
+
+            case 'r':
+                ok = argCount >= 3 && within(arg[1], 0, 255) && arg[2] >= 0 && (argCount == 3 || arg[3] >= 0);
+                if (ok)
+                {
+                    runShowCommand(showRamp(arg[0], arg[1], arg[2], argCount > 3 ? arg[3] : 0));
+                }
+                break;
+
+            case 'w':
+                ok = argCount >= 4 && arg[1] > 0 && within(arg[2], 0, 255) && within(arg[3], 0, 255);
+                if (ok)
+                {
+                    runShowCommand(showSinusoid(arg[0], arg[1], arg[2], arg[3], argCount > 4 ? arg[4] : 0));
+                }
+                break;
+
+            case 'k':
+                ok = (argCount == 3 || argCount == 5) && within(arg[1], 0, 255) && within(arg[2], 0, 255);
+                ok = ok && (argCount == 3 || (within(arg[3], 1, 255) && within(arg[4], 0, 255)));
+                if (ok && argCount == 5)
+                {
+                    runShowCommand(showFlicker(arg[0], arg[1], arg[2], 0, 0, arg[3], arg[4]));
+                }
+                else if (ok)
+                {
+                    runShowCommand(showFlicker(arg[0], arg[1], arg[2], 0));
+                }
+                break;
+
+            case 'l':
+                ok = argCount == 2 && within(arg[1], 0, 255);
+                if (ok)
+                {
+                    config.limit[arg[0]] = arg[1];
+                    leds.setLimit(arg[0], arg[1]);
+                    saveConfig();
+                }
+                break;
+
+            case 'u':
+                ok = argCount == 1 && within(arg[0], 0, 1);
+                if (ok)
+                {
+                    config.resume = arg[0];
+                    saveConfig();
+                }
+                break;
+
+            case 't':
+                Serial.print(F("state "));
+                Serial.print(falconState);
+                Serial.print(holdState ? F(" held ") : F(" "));
+                Serial.print(holdState ? heldAt : Tick(now - stateStartTime));
+                Serial.print('/');
+                Serial.println(nextState.timeToSwitch);
+                break;
+
+#ifdef PROFILE_FRAMES
+            case 'p':
+                profiler.report(scheduler.takeOverruns());
+                break;
+#endif
+
+#ifdef MEMORY_REPORT
+            case 'm':
+                reportMemory();
+                break;
+#endif
+
+            default:
+                ok = false;
+                break;
         }
     }
 
-    return {5000, FalconState::OnGround};
+    Serial.println(ok ? F("ok") : F("?"));
 }
+#endif
 
 void setup()
 {
-    randomSeed(generateRandomSeed());
+#if defined(PROFILE_FRAMES) || defined(SERIAL_CONSOLE) || defined(MEMORY_REPORT) || defined(SYNC_MASTER) || defined(SYNC_FOLLOWER) || defined(OUTPUT_TRACE)
+    Serial.begin(115200);
+#endif
+
+    // A saved config carries on the random sequence, so the eight ADC
+    // reads are only needed on the first boot.
+    if (configStore.load(config))
+    {
+        showRandom.seed(config.randomState);
+    }
+    else
+    {
+        showRandom.seed(generateRandomSeed());
+        config.state = FalconState::OnGround;
+        config.resume = true;
+        memset(config.limit, 255, sizeof(config.limit));
+    }
+    leds.seed(showRandom.next());
 
     engine.setup();
 
-    cockpit.init();
-    headlights.init();
-    landingLights.init();
+    leds.init(cockpitLed, 3);
+    leds.init(headlightsLed, 5);
+    leds.init(landingLightsLed, 6);
+
+    leds.on(cockpitLed, 255);
+    leds.off(headlightsLed);
+    leds.on(landingLightsLed, 255);
 
-    cockpit.on(255);
-    headlights.off();
-    landingLights.on(255);
+#ifdef SOFT_PWM
+    leds.init(turretsLed, 2);
+    leds.init(holdLed, 4);
+    leds.init(navBeaconLed, 7);
 
-    stateStartTime = millis();
-    nextState = nextFalconState(FalconState::OnGround);
+    leds.off(turretsLed);
+    leds.on(holdLed, 96);
+    leds.startSinusoid(navBeaconLed, 1200, 0, 255);
+#endif
+
+#ifdef CURRENT_BUDGET
+    output().setBudget(currentBudget);
+#endif
+    for (uint8_t ch = 0; ch < ledCount; ++ch)
+    {
+        leds.setLimit(ch, config.limit[ch]);
+#ifdef CURRENT_BUDGET
+        output().setRating(ch, ledRating[ch]);
+#endif
+    }
+
+    bool resume = config.resume && config.state < falconStateCount;
+    stateStartTime = ticks();
+    nextState = nextFalconState(resume ? FalconState(config.state) : FalconState::OnGround);
+    leds.selfTest(250);
+
+#ifdef AUDIO_ENGINE
+    // The ADC free-runs from here on, so analogRead() is off limits.
+    audio.begin(audioChannel);
+#endif
+    scheduler.begin();
 }
 
 void loop()
 {
-    unsigned int now = millis();
-    if (now - stateStartTime > nextState.timeToSwitch)
+    scheduler.waitForFrame();
+    uint16_t frameStart = profiler.start();
+
+#ifdef SYNC_FOLLOWER
+    SyncState heard;
+    if (sync.poll(heard) && heard.state < falconStateCount)
+    {
+        showRandom.seed(heard.randomState);
+        stateStartTime = ticks();
+        nextState = nextFalconState(FalconState(heard.state));
+    }
+#endif
+
+    Tick now = ticks();
+#ifdef OUTPUT_TRACE
+    leds.outputStage().setTime(now);
+#endif
+#ifdef SYNC_FOLLOWER
+    bool leading = !sync.locked(now);
+#else
+    const bool leading = true;
+#endif
+    if (leading && !holdState && Tick(now - stateStartTime) > nextState.timeToSwitch)
     {
+        uint16_t started = profiler.start();
         stateStartTime = now;
         nextState = nextFalconState(nextState.next);
+        profiler.record(profileTransition, started);
     }
 
-    engine.loop(now);
-    cockpit.update(now);
-    headlights.update(now);
-    landingLights.update(now);
+    saveShowState(now);
+    configStore.service();
+#ifdef SYNC_MASTER
+    sync.sendClock(now);
+#endif
+
+#ifdef AUDIO_ENGINE
+    engine.setInput(audio.level());
+#endif
+
+    uint16_t started = profiler.start();
+    leds.update(now);
+    profiler.record(profileLeds, started);
+
+    profiler.record(profileFrame, frameStart);
+
+#ifdef DEEP_SLEEP
+    // Nothing will change before the next show state, so sleep towards it.
+    // millis() stops while powered down; the ticks catch up here.
+    Tick elapsed = ticks() - stateStartTime;
+    bool dimmed = false;    // a dimmed output isn't fully on
+#ifdef CURRENT_BUDGET
+    dimmed = output().limiting();
+#endif
+    bool bamSettled = true;    // SoftPwm may still be rebuilding or swapping planes
+#ifdef SOFT_PWM
+    bamSettled = softPwm.idle();
+#endif
+    if (elapsed < nextState.timeToSwitch && !dimmed && bamSettled && configStore.idle() && leds.isStatic())
+    {
+        tickOffset += scheduler.powerDown(nextState.timeToSwitch - elapsed);
+    }
+#endif
+
+#ifdef SERIAL_CONSOLE
+    ConsoleCommand command;
+    if (console.poll(command))
+    {
+        runConsoleCommand(command, now);
+    }
+#elif defined(PROFILE_FRAMES) || defined(MEMORY_REPORT)
+    switch (Serial.read())
+    {
+#ifdef PROFILE_FRAMES
+        case 'p':
+            profiler.report(scheduler.takeOverruns());
+            break;
+#endif
+#ifdef MEMORY_REPORT
+        case 'm':
+            reportMemory();
+            break;
+#endif
+    }
+#endif
+
+#ifdef OUTPUT_TRACE
+    // Only as much as fits in the TX buffer, so the frame never waits.
+#ifdef FALCON_SIM
+    leds.outputStage().drain(simTraceWrite, traceBufferSize);
+#else
+    leds.outputStage().drain([](uint8_t byte) { Serial.write(byte); }, Serial.availableForWrite());
+#endif
+#endif
 }
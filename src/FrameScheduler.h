@@ -0,0 +1,161 @@
+/*
+  FrameScheduler
+
+  Fixed-rate frame tick for loop(), with the CPU idle-sleeping between
+  frames.
+
+  Every hardware timer on the Nano already drives one of the LED PWM pins,
+  so the tick piggybacks on Timer0 instead of claiming a timer of its own.
+  Timer0 runs in fast PWM mode for millis() and pins 5/6; OCR0A is double
+  buffered in that mode, so its compare-match interrupt fires exactly once
+  per timer cycle (16 MHz / 64 / 256 = 976.5625 Hz) whatever duty pin 6 is
+  showing. The ISR divides that base rate down to FRAME_RATE_HZ with a
+  Bresenham accumulator, so the average rate is exact and the jitter is
+  under one timer cycle (~1 ms).
+
+  Frames that are missed because a frame overran are coalesced: the
+  animations are driven by millis(), so running one late frame is enough.
+  With PROFILE_FRAMES defined the ISR counts them for the profiler.
+
+  powerDown() is for stretches where nothing changes: it stops every clock
+  but the watchdog's, which wakes the CPU after one of its fixed periods.
+  Timer0 is stopped too, so millis() doesn't see that time. PWM outputs
+  hold whatever level they were at, which only reads as the right value
+  for pins that are fully off or fully on.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+#ifndef FRAME_RATE_HZ
+#define FRAME_RATE_HZ 200
+#endif
+
+static_assert(FRAME_RATE_HZ > 0 && FRAME_RATE_HZ <= 976,
+    "FRAME_RATE_HZ must not exceed the 976 Hz Timer0 base tick");
+
+#ifdef __AVR__
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+// The Timer0 cycle rate is 15625 / 16 Hz.
+const uint16_t timer0CyclesPerSecondX16 = 15625;
+
+volatile bool framePending = false;
+uint16_t frameAccumulator = 0;
+#ifdef PROFILE_FRAMES
+volatile uint8_t frameOverruns = 0;
+#endif
+
+ISR(TIMER0_COMPA_vect)
+{
+    frameAccumulator += FRAME_RATE_HZ * 16;
+    if (frameAccumulator >= timer0CyclesPerSecondX16)
+    {
+        frameAccumulator -= timer0CyclesPerSecondX16;
+#ifdef PROFILE_FRAMES
+        if (framePending && frameOverruns < 255)
+        {
+            ++frameOverruns;
+        }
+#endif
+        framePending = true;
+    }
+}
+
+ISR(WDT_vect)
+{
+}
+#endif
+
+class FrameScheduler
+{
+  public:
+    void begin()
+    {
+#ifdef __AVR__
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        TIFR0 = _BV(OCF0A);
+        TIMSK0 |= _BV(OCIE0A);
+#endif
+    }
+
+    // Sleep until the next frame is due. In the host simulator this
+    // advances the simulated clock by one frame instead.
+    void waitForFrame()
+    {
+#ifdef FALCON_SIM
+        simWaitForFrame(FRAME_RATE_HZ);
+#endif
+#ifdef __AVR__
+        cli();
+        while (!framePending)
+        {
+            // sei() only takes effect after the next instruction, so no
+            // interrupt can slip in between the check and sleep_cpu().
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+            cli();
+        }
+        framePending = false;
+        sei();
+#endif
+    }
+
+    // Power down for the longest watchdog period, 16 ms to 8 s, that fits
+    // in ms, and return its length (0 if ms is under 16). The watchdog
+    // oscillator is only good to about 10%.
+    uint16_t powerDown(uint16_t ms)
+    {
+        if (ms < 16)
+        {
+            return 0;
+        }
+
+        uint8_t prescale = 0;
+        while (prescale < 9 && uint16_t(32) << prescale <= ms)
+        {
+            ++prescale;
+        }
+        uint16_t period = uint16_t(16) << prescale;
+
+#ifdef FALCON_SIM
+        simPowerDown(period);
+#endif
+#ifdef __AVR__
+        cli();
+        wdt_reset();
+        MCUSR &= ~_BV(WDRF);
+        WDTCSR = _BV(WDCE) | _BV(WDE);
+        WDTCSR = _BV(WDIE) | (prescale & 7) | (prescale & 8 ? _BV(WDP3) : 0);
+
+        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+        sleep_enable();
+        sleep_bod_disable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+        cli();
+        WDTCSR = _BV(WDCE) | _BV(WDE);
+        WDTCSR = 0;
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        sei();
+#endif
+        return period;
+    }
+
+    // Number of frames coalesced since the last call.
+    uint8_t takeOverruns()
+    {
+#if defined(__AVR__) && defined(PROFILE_FRAMES)
+        uint8_t overruns = frameOverruns;
+        frameOverruns = 0;
+        return overruns;
+#else
+        return 0;
+#endif
+    }
+};
@@ -0,0 +1,677 @@
+/*
+  LedBank
+
+  Animation state for every LED channel, stored as one array per field
+  rather than one object per LED. The whole bank is updated in a single
+  loop. State only one kind of mode needs shares storage with the others
+  (a flicker has no period, a ramp no noise rows), so a channel costs 31
+  bytes of SRAM, its wakeup slot included, plus about 9 in PwmOutput or
+  2 in PinPwmOutput.
+  Channels are addressed by index, and Output decides how a channel's
+  value reaches its pin.
+
+  A channel that can no longer change (on, off, or a finished ramp) is
+  marked settled and skipped by update() until it is given a new mode.
+
+  Levels are PWM duty unless a channel has gamma enabled, in which case
+  they are perceptual brightness and go through gammaTable on the way out.
+  Each channel also has a brightness limit its levels are scaled to. The
+  animations themselves always work on the unscaled level, and hand it
+  to the output as 8.8 fixed point so high-resolution and dithering
+  backends get the fraction.
+
+  selfTest() lights every channel at once for a moment without blocking.
+  The animations keep running underneath and take over when it ends.
+
+  A sinusoid, flicker or follower doesn't start where the old mode left
+  off, so it is crossfaded in: the output at the mode change is kept and
+  blended linearly into the new mode over crossfadeTime ms. Ramps and
+  envelopes start from the current output and need no crossfade.
+
+  A channel with nothing to do until a known time (a start delay, or a
+  flicker between levels) sleeps in an EventQueue instead of being looked
+  at every frame, so waiting channels cost nothing until they are due.
+
+  Times are 16-bit Ticks. A start delay is folded into the start tick once
+  it has passed, and a sinusoid's start tick moves forward a whole period
+  at a time, so every difference update() takes stays short however long
+  the show runs. A difference that comes out negative means the mode
+  hasn't started yet, so periods and keyframes have to be under 32.7 s.
+
+  Flicker picks a new level at explicitly scheduled times, a mean interval
+  plus or minus a jitter, so its look doesn't depend on the frame rate.
+  The pink variant sums octave-spaced random rows (Voss-McCartney) for
+  1/f-style noise, which drifts more like a failing circuit than white
+  noise does.
+
+  An external channel is driven by a level the sketch feeds in every
+  frame through setInput(), such as a sound level, scaled to min..max.
+
+  An envelope plays a list of keyframes from flash, each moving to a level
+  over dt ms along a curve, and settles on the last level. Only the
+  current keyframe is looked at in a frame, however long the list is.
+
+  A channel can follow a leader with a lower index (see LedGroup). It
+  reuses the waveform position or noise sample the leader computed in the
+  same frame, shifted by its own phase or mapped to its own range, so a
+  group stays exactly in step and its waveform is evaluated once. For any
+  other leader mode the follower mirrors the leader's output.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "EventQueue.h"
+#include "PwmOutput.h"
+#include "Random.h"
+#include "SimCost.h"
+#include "Tick.h"
+#include "Waveform.h"
+
+enum class LedMode : uint8_t
+{
+    on,
+    off,
+    ramp,
+    sinusoid,
+    flicker,
+    pinkFlicker,
+    envelope,
+    follow,
+    external
+};
+
+enum class Curve : uint8_t
+{
+    linear,
+    ease,    // cosine ease in and out
+    hold     // stay at the previous level, then jump at the end
+};
+
+struct Keyframe
+{
+    uint16_t dt;
+    uint8_t level;
+    Curve curve;
+};
+
+const uint8_t pinkRows = 3;
+
+// LedBank channel flags.
+const uint8_t ledSettled = 0x01;    // skipped by update()
+const uint8_t ledFading = 0x02;     // still crossfading from fadeFrom
+const uint8_t ledGamma = 0x04;      // levels are perceptual, see gamma8()
+const uint8_t ledAsleep = 0x08;     // skipped by update() until its wakeup
+
+// A power of two of at least 256 ms, so the blend factor is a shift.
+const uint16_t crossfadeTime = 512;
+static_assert(crossfadeTime >= 256 && (crossfadeTime & (crossfadeTime - 1)) == 0,
+    "crossfadeTime must be a power of two of at least 256 ms");
+
+template <uint8_t N, class Output = PwmOutput<N>>
+class LedBank
+{
+    Output output;
+
+    LedMode mode[N];
+    uint8_t flags[N];
+    uint8_t minBright[N];
+    uint8_t maxBright[N];
+    uint16_t level[N];    // 8.8
+    uint8_t limit[N];
+
+    uint16_t delay[N];
+    uint16_t noise[N];
+    uint16_t wave[N];    // sinusoid position, raw flicker level or input, for followers
+
+    // Ramps, sinusoids, envelopes and followers run over a period; a
+    // flickering channel has none, so the two share their storage.
+    struct Timed
+    {
+        uint16_t period;
+        uint32_t periodRecip;
+        union
+        {
+            uint16_t phase;              // sinusoid and follow
+            const Keyframe* keyframe;    // envelope, in flash
+        };
+        union
+        {
+            uint8_t leader;              // follow
+            uint8_t keyframesLeft;       // envelope, after the current one
+        };
+    };
+
+    struct Flicker
+    {
+        Tick at;
+        uint8_t mean;
+        uint8_t jitter;
+        uint8_t pinkCount;
+        uint8_t pink[pinkRows];
+    };
+
+    union ModeState
+    {
+        Timed timed;
+        Flicker flicker;
+    };
+    ModeState modeState[N];
+
+    Tick startTime[N];
+    Tick fadeStart[N];
+    uint16_t fadeFrom[N];
+
+    EventQueue<N> wakeups;
+
+    bool testing = false;
+    Tick testUntil;
+    bool written = false;       // since the last commit
+    bool committed = false;     // by the last update()
+
+    uint8_t flickerLevel(uint8_t ch)
+    {
+        Flicker& flicker = modeState[ch].flicker;
+        uint8_t level = xorshift16(noise[ch]) >> 8;
+        if (mode[ch] == LedMode::pinkFlicker)
+        {
+            // Row k is redrawn every 2^(k+1) changes; the fresh white
+            // sample is the fourth term.
+            uint8_t count = ++flicker.pinkCount;
+            for (uint8_t row = 0; row < pinkRows; ++row, count >>= 1)
+            {
+                if (count & 1)
+                {
+                    flicker.pink[row] = xorshift16(noise[ch]) >> 8;
+                    break;
+                }
+            }
+
+            uint16_t sum = level;
+            for (uint8_t row = 0; row < pinkRows; ++row)
+            {
+                sum += flicker.pink[row];
+            }
+            level = sum >> 2;
+        }
+
+        return level;
+    }
+
+    uint16_t flickerInterval(uint8_t ch)
+    {
+        Flicker& flicker = modeState[ch].flicker;
+        uint8_t jitter = flicker.jitter;
+        return flicker.mean - jitter + scaleRandom(xorshift16(noise[ch]), 2 * jitter + 1);
+    }
+
+    uint16_t sinusoidLevel(uint8_t ch, uint16_t pos)
+    {
+#ifdef FLOAT_WAVEFORM
+        auto v = (cos(2 * M_PI * (pos / 65536.0 - 0.5)) + 1) / 2;
+        return (minBright[ch] << 8) + int((maxBright[ch] - minBright[ch]) * v * 256);
+#else
+        return lerp16(minBright[ch], maxBright[ch], cosWave16(pos));
+#endif
+    }
+
+    // Snapshot the output to crossfade from when a new mode starts.
+    void startFade(uint8_t ch)
+    {
+        setFlags(ch, ledFading);
+        fadeFrom[ch] = level[ch];
+        fadeStart[ch] = ticks();
+    }
+
+    // Replace the mode flags, keeping the gamma setting and dropping any
+    // pending wakeup.
+    void setFlags(uint8_t ch, uint8_t f)
+    {
+        if (flags[ch] & ledAsleep)
+        {
+            wakeups.remove(ch);
+        }
+        flags[ch] = (flags[ch] & ledGamma) | f;
+    }
+
+    // At most one wakeup per channel is pending, so the queue never fills.
+    void sleepUntil(uint8_t ch, Tick when)
+    {
+        flags[ch] |= ledAsleep;
+        wakeups.push(when, ch);
+    }
+
+    // update() takes no notice of the channel until d ms from now.
+    void startAfter(uint8_t ch, uint16_t d)
+    {
+        delay[ch] = d;
+        startTime[ch] = ticks();
+        if (d)
+        {
+            sleepUntil(ch, startTime[ch] + d);
+        }
+    }
+
+    uint16_t duty(uint8_t ch, uint16_t value) const
+    {
+        SIM_COST(simOpMul16);
+        value = (uint32_t(value) * (limit[ch] + 1)) >> 8;
+        return flags[ch] & ledGamma ? gamma16(value) : value;
+    }
+
+    void show(uint8_t ch, uint16_t value)
+    {
+        level[ch] = value;
+        if (!testing)
+        {
+            output.write(ch, duty(ch, value));
+            written = true;
+        }
+    }
+
+    // Start the segment towards keyframe k, from the level reached so far.
+    void loadKeyframe(uint8_t ch, const Keyframe* k)
+    {
+        modeState[ch].timed.keyframe = k;
+        minBright[ch] = maxBright[ch];
+        maxBright[ch] = pgm_read_byte(&k->level);
+        setPeriod(ch, pgm_read_word(&k->dt));
+    }
+
+    // Precompute the reciprocal so update() only multiplies.
+    void setPeriod(uint8_t ch, uint16_t pd)
+    {
+        modeState[ch].timed.period = pd;
+        modeState[ch].timed.periodRecip = reciprocal(pd);
+    }
+
+  public:
+    // The output backend, for settings of its own such as CurrentLimit's.
+    Output& outputStage()
+    {
+        return output;
+    }
+
+    void init(uint8_t ch, uint8_t pn)
+    {
+        output.attach(ch, pn);
+        mode[ch] = LedMode::off;
+        flags[ch] = ledSettled;
+        minBright[ch] = 0;
+        maxBright[ch] = 255;
+        level[ch] = 0;
+        limit[ch] = 255;
+        setPeriod(ch, 1000);
+        modeState[ch].timed.phase = 0;
+        delay[ch] = 0;
+        startTime[ch] = ticks();
+    }
+
+    // Light every channel fully for duration ms, from the next update().
+    void selfTest(uint16_t duration)
+    {
+        testing = true;
+        testUntil = ticks() + duration;
+        for (uint8_t ch = 0; ch < N; ++ch)
+        {
+            output.write(ch, duty(ch, 0xff00));
+        }
+        output.commit();
+    }
+
+    void setLimit(uint8_t ch, uint8_t cap)
+    {
+        limit[ch] = cap;
+        show(ch, level[ch]);
+    }
+
+    void setGamma(uint8_t ch, bool enable)
+    {
+        flags[ch] = enable ? flags[ch] | ledGamma : flags[ch] & ~ledGamma;
+        show(ch, level[ch]);
+    }
+
+    // Give every channel its own non-zero flicker generator state.
+    void seed(uint16_t s)
+    {
+        for (uint8_t ch = 0; ch < N; ++ch)
+        {
+            uint16_t state = s ^ (ch * 0x9e37u);
+            noise[ch] = state ? state : 1;
+        }
+    }
+
+    void update(Tick now)
+    {
+        if (testing)
+        {
+            if (int16_t(now - testUntil) < 0)
+            {
+                return;
+            }
+            testing = false;
+            for (uint8_t ch = 0; ch < N; ++ch)
+            {
+                show(ch, level[ch]);
+            }
+        }
+
+        uint8_t woken;
+        while (wakeups.popDue(now, woken))
+        {
+            flags[woken] &= ~ledAsleep;
+        }
+
+        for (uint8_t ch = 0; ch < N; ++ch)
+        {
+            if (flags[ch] & (ledSettled | ledAsleep))
+            {
+                continue;
+            }
+            SIM_COST(simOpChannel);
+
+            // A delayed channel sleeps until its delay is over.
+            Tick delta = now - startTime[ch];
+            if (delay[ch])
+            {
+                startTime[ch] += delay[ch];
+                delta -= delay[ch];
+                delay[ch] = 0;
+                fadeStart[ch] = startTime[ch];
+            }
+
+            // A mode started after now was read, or a sync follower's
+            // clock set back, puts the start ahead of now. The channel
+            // then stays at its start until now catches up.
+            if (int16_t(delta) < 0)
+            {
+                delta = 0;
+            }
+
+            bool fading = flags[ch] & ledFading;
+            Tick fadeElapsed = now - fadeStart[ch];
+            if (int16_t(fadeElapsed) < 0)
+            {
+                fadeElapsed = 0;
+            }
+            if (fading && fadeElapsed >= crossfadeTime)
+            {
+                flags[ch] &= ~ledFading;
+                fading = false;
+            }
+
+            uint16_t value = 0;
+            switch (mode[ch])
+            {
+                case LedMode::off:
+                    value = 0;
+                    break;
+
+                case LedMode::on:
+                    value = maxBright[ch] << 8;
+                    break;
+
+                case LedMode::ramp:
+                {
+                    Timed& timed = modeState[ch].timed;
+                    if (delta >= timed.period)
+                    {
+                        value = maxBright[ch] << 8;
+                        flags[ch] |= ledSettled;
+                        break;
+                    }
+
+                    value = lerp16(minBright[ch], maxBright[ch], fraction16(delta, timed.periodRecip));
+                    break;
+                }
+
+                case LedMode::sinusoid:
+                {
+                    Timed& timed = modeState[ch].timed;
+                    while (delta >= timed.period)
+                    {
+                        startTime[ch] += timed.period;
+                        delta -= timed.period;
+                    }
+                    uint16_t at = delta + timed.phase;
+                    if (at >= timed.period)
+                    {
+                        at -= timed.period;
+                    }
+                    wave[ch] = fraction16(at, timed.periodRecip);
+                    value = sinusoidLevel(ch, wave[ch]);
+                    break;
+                }
+
+                case LedMode::envelope:
+                {
+                    Timed& timed = modeState[ch].timed;
+                    while (delta >= timed.period && timed.keyframesLeft)
+                    {
+                        startTime[ch] += timed.period;
+                        delta -= timed.period;
+                        --timed.keyframesLeft;
+                        loadKeyframe(ch, timed.keyframe + 1);
+                    }
+
+                    if (delta >= timed.period)
+                    {
+                        value = maxBright[ch] << 8;
+                        flags[ch] |= ledSettled;
+                        break;
+                    }
+
+                    uint16_t frac = fraction16(delta, timed.periodRecip);
+                    switch (Curve(pgm_read_byte(&timed.keyframe->curve)))
+                    {
+                        case Curve::linear:
+                            break;
+
+                        case Curve::ease:
+                            frac = cosWave16(frac >> 1);
+                            break;
+
+                        case Curve::hold:
+                            frac = 0;
+                            break;
+                    }
+                    value = lerp16(minBright[ch], maxBright[ch], frac);
+                    break;
+                }
+
+                case LedMode::flicker:
+                case LedMode::pinkFlicker:
+                {
+                    Flicker& flicker = modeState[ch].flicker;
+                    // The held level comes from wave[], not the output,
+                    // which is blended while a crossfade is running.
+                    if (int16_t(now - flicker.at) >= 0)
+                    {
+                        wave[ch] = flickerLevel(ch);
+                        flicker.at = now + flickerInterval(ch);
+                    }
+                    value = lerp8(minBright[ch], maxBright[ch], wave[ch]) << 8;
+                    if (!fading)
+                    {
+                        sleepUntil(ch, flicker.at);
+                    }
+                    break;
+                }
+
+                case LedMode::external:
+                    value = lerp8(minBright[ch], maxBright[ch], wave[ch]) << 8;
+                    break;
+
+                case LedMode::follow:
+                {
+                    uint8_t lead = modeState[ch].timed.leader;
+                    switch (mode[lead])
+                    {
+                        case LedMode::sinusoid:
+                            value = sinusoidLevel(ch, wave[lead] + modeState[ch].timed.phase);
+                            break;
+
+                        case LedMode::flicker:
+                        case LedMode::pinkFlicker:
+                        case LedMode::external:
+                            value = lerp8(minBright[ch], maxBright[ch], wave[lead]) << 8;
+                            break;
+
+                        default:
+                            value = level[lead];
+                            if ((flags[lead] & ledSettled) && !fading)
+                            {
+                                flags[ch] |= ledSettled;
+                            }
+                            break;
+                    }
+                    break;
+                }
+            }
+
+            if (fading)
+            {
+                value = mix16(fadeFrom[ch], value, fadeElapsed / (crossfadeTime / 256));
+            }
+
+            if (value != level[ch])
+            {
+                show(ch, value);
+            }
+        }
+
+        output.commit();
+        committed = written;
+        written = false;
+    }
+
+    void off(uint8_t ch)
+    {
+        mode[ch] = LedMode::off;
+        setFlags(ch, ledSettled);
+        show(ch, 0);
+    }
+
+    void on(uint8_t ch, uint8_t mx)
+    {
+        mode[ch] = LedMode::on;
+        setFlags(ch, ledSettled);
+        maxBright[ch] = mx;
+        show(ch, mx << 8);
+    }
+
+    // The new mode takes effect from the next update().
+    void rampTo(uint8_t ch, uint8_t mx, uint16_t pd, uint16_t d = 0)
+    {
+        mode[ch] = LedMode::ramp;
+        setFlags(ch, 0);
+        minBright[ch] = round8(level[ch]);
+        maxBright[ch] = mx;
+        setPeriod(ch, pd);
+        startAfter(ch, d);
+    }
+
+    void startSinusoid(uint8_t ch, uint16_t pd, uint8_t mn, uint8_t mx, int ph = 0)
+    {
+        mode[ch] = LedMode::sinusoid;
+        startFade(ch);
+        minBright[ch] = mn;
+        maxBright[ch] = mx;
+        setPeriod(ch, pd);
+        delay[ch] = 0;
+        ph %= int(pd);
+        modeState[ch].timed.phase = ph < 0 ? ph + pd : ph;
+        startTime[ch] = ticks();
+    }
+
+    // Play count keyframes from flash, starting at the current level.
+    void startEnvelope(uint8_t ch, const Keyframe* keyframes, uint8_t count)
+    {
+        mode[ch] = LedMode::envelope;
+        setFlags(ch, 0);
+        maxBright[ch] = round8(level[ch]);
+        loadKeyframe(ch, keyframes);
+        modeState[ch].timed.keyframesLeft = count - 1;
+        delay[ch] = 0;
+        startTime[ch] = ticks();
+    }
+
+    template <size_t C>
+    void startEnvelope(uint8_t ch, const Keyframe (&keyframes)[C])
+    {
+        static_assert(C > 0 && C <= 255, "an envelope needs 1 to 255 keyframes");
+        startEnvelope(ch, keyframes, C);
+    }
+
+    // New levels come every mean +/- jitter ms (jitter is capped at mean).
+    void startFlicker(uint8_t ch, uint8_t mn, uint8_t mx, uint16_t d, uint8_t mean = 29,
+        uint8_t jitter = 12, bool pinkNoise = false)
+    {
+        mode[ch] = pinkNoise ? LedMode::pinkFlicker : LedMode::flicker;
+        startFade(ch);
+        minBright[ch] = mn;
+        maxBright[ch] = mx;
+        startAfter(ch, d);
+        Flicker& flicker = modeState[ch].flicker;
+        flicker.at = startTime[ch] + d;
+        flicker.mean = mean;
+        flicker.jitter = min(jitter, mean);
+        flicker.pinkCount = 0;
+        memset(flicker.pink, 0, sizeof(flicker.pink));
+        wave[ch] = 0;
+    }
+
+    // True when no channel can change until it is given a new mode and
+    // every output is fully off or fully on, so the outputs hold their
+    // value with the PWM timers stopped. The OCR registers only take a new
+    // value at the end of a PWM cycle, so it also waits for an update()
+    // that put nothing out.
+    bool isStatic() const
+    {
+        if (testing || committed || written)
+        {
+            return false;
+        }
+        for (uint8_t ch = 0; ch < N; ++ch)
+        {
+            uint16_t out = duty(ch, level[ch]);
+            if (!(flags[ch] & ledSettled) || (out != 0 && out < 0xff00))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Scale the level last given to setInput() to mn..mx, starting dark.
+    void startExternal(uint8_t ch, uint8_t mn, uint8_t mx)
+    {
+        mode[ch] = LedMode::external;
+        startFade(ch);
+        minBright[ch] = mn;
+        maxBright[ch] = mx;
+        delay[ch] = 0;
+        wave[ch] = 0;
+    }
+
+    // Takes effect from the next update(); followers map it to their own range.
+    void setInput(uint8_t ch, uint8_t input)
+    {
+        wave[ch] = input;
+    }
+
+    // Track lead, which must have a lower index than ch, ph / 65536 of a
+    // period ahead and scaled to mn..mx. The follower has to be restarted
+    // whenever the leader gets a new mode.
+    void follow(uint8_t ch, uint8_t lead, uint16_t ph, uint8_t mn, uint8_t mx)
+    {
+        mode[ch] = LedMode::follow;
+        startFade(ch);
+        modeState[ch].timed = modeState[lead].timed;
+        modeState[ch].timed.leader = lead;
+        modeState[ch].timed.phase = ph;
+        minBright[ch] = mn;
+        maxBright[ch] = mx;
+        delay[ch] = 0;
+        startTime[ch] = ticks();
+    }
+};
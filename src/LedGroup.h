@@ -0,0 +1,94 @@
+/*
+  LedGroup
+
+  A run of consecutive LedBank channels animated as one. The first channel
+  leads and the others follow it (see LedBank::follow()): a group
+  sinusoid is evaluated once per frame and spread evenly around the
+  period, and a group flicker shares one noise source, with each channel
+  mapping it to its own range. An external group works the same way on
+  the level fed to its first channel.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "LedBank.h"
+
+template <class Bank>
+class LedGroup
+{
+    Bank& leds;
+    uint8_t first;
+    uint8_t count;
+
+  public:
+    LedGroup(Bank& bank, uint8_t firstChannel, uint8_t channelCount)
+        : leds(bank), first(firstChannel), count(channelCount)
+    {
+    }
+
+    void off()
+    {
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            leds.off(first + i);
+        }
+    }
+
+    // Ramps start from each channel's own level, so they aren't shared.
+    void rampTo(uint8_t mx, uint16_t pd)
+    {
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            leds.rampTo(first + i, mx, pd);
+        }
+    }
+
+    template <size_t C>
+    void startEnvelope(const Keyframe (&keyframes)[C])
+    {
+        leds.startEnvelope(first, keyframes);
+        followAll();
+    }
+
+    // Channel i runs i / count of a period ahead of the first.
+    void startSinusoid(uint16_t pd, uint8_t mn, uint8_t mx)
+    {
+        leds.startSinusoid(first, pd, mn, mx);
+        uint16_t step = 0x10000UL / count;
+        for (uint8_t i = 1; i < count; ++i)
+        {
+            leds.follow(first + i, first, i * step, mn, mx);
+        }
+    }
+
+    // ranges holds a {min, max} pair per channel.
+    void startFlicker(const uint8_t (*ranges)[2], uint8_t mean = 29, uint8_t jitter = 12,
+        bool pinkNoise = false)
+    {
+        leds.startFlicker(first, ranges[0][0], ranges[0][1], 0, mean, jitter, pinkNoise);
+        for (uint8_t i = 1; i < count; ++i)
+        {
+            leds.follow(first + i, first, 0, ranges[i][0], ranges[i][1]);
+        }
+    }
+
+    // The first channel takes setInput(); ranges is as for startFlicker().
+    void startExternal(const uint8_t (*ranges)[2])
+    {
+        leds.startExternal(first, ranges[0][0], ranges[0][1]);
+        for (uint8_t i = 1; i < count; ++i)
+        {
+            leds.follow(first + i, first, 0, ranges[i][0], ranges[i][1]);
+        }
+    }
+
+  private:
+    // Mirror the first channel's output.
+    void followAll()
+    {
+        for (uint8_t i = 1; i < count; ++i)
+        {
+            leds.follow(first + i, first, 0, 0, 255);
+        }
+    }
+};
@@ -0,0 +1,88 @@
+/*
+  MemoryProfile
+
+  Where the ATmega328's 2 KB of SRAM goes. Static data sits at the bottom
+  of SRAM and the stack grows down from the top; when they meet, the
+  sketch corrupts itself and resets.
+
+  Before the C runtime starts, paintStack() fills everything between the
+  end of static data and the top of SRAM with a marker byte. Whatever
+  the stack (or a heap) has since touched no longer holds the marker, so
+  stackHeadroom() counts the bytes that have never been used since boot:
+  the margin left at the deepest call so far, interrupts included. The
+  Nano build carries nothing else between static data and the stack, as
+  nothing in the sketch allocates.
+
+  memoryLine() prints one "name bytes" line of the sketch's report. On
+  the host there is no SRAM layout to inspect, so only the sizes of the
+  sketch's objects are meaningful.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+#ifdef __AVR__
+
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+const uint8_t stackPaint = 0xc5;
+
+// Runs in .init1, before the stack pointer and r1 are set up, so it is
+// written in assembly and touches no stack.
+void paintStack() __attribute__((naked, used, section(".init1")));
+void paintStack()
+{
+    __asm__ volatile(
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :
+        : "i"(stackPaint));
+}
+
+// Static data: .data, .bss and .noinit.
+inline uint16_t staticRam()
+{
+    return &_end - &__data_start;
+}
+
+inline uint16_t stackHeadroom()
+{
+    const uint8_t* p = &_end;
+    while (p <= &__stack && *p == stackPaint)
+    {
+        ++p;
+    }
+    return p - &_end;
+}
+
+#else
+
+inline uint16_t staticRam()
+{
+    return 0;
+}
+
+inline uint16_t stackHeadroom()
+{
+    return 0;
+}
+
+#endif
+
+template <class Name>
+inline void memoryLine(Name name, uint16_t bytes)
+{
+    Serial.print(name);
+    Serial.print(' ');
+    Serial.println(bytes);
+}
@@ -0,0 +1,126 @@
+/*
+  Profiler
+
+  Opt-in frame timing. With PROFILE_FRAMES defined, every frame stage is
+  timed with micros() (4 us resolution on a 16 MHz Nano). The last
+  profileWindow samples of each stage are kept in a ring buffer, and
+  report() prints their min/avg/max and the peak since the previous report
+  over Serial. Without PROFILE_FRAMES the calls compile to nothing.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+enum ProfileStage : uint8_t
+{
+    profileTransition,
+    profileLeds,
+    profileFrame,
+    profileStageCount
+};
+
+#ifdef PROFILE_FRAMES
+
+const uint8_t profileWindow = 16;    // power of two
+
+class Profiler
+{
+    uint16_t samples[profileStageCount][profileWindow];
+    uint8_t next[profileStageCount];
+    uint8_t filled[profileStageCount];
+    uint16_t peak[profileStageCount];
+
+    // Through F(), so the names stay in flash.
+    static void printName(uint8_t stage)
+    {
+        switch (stage)
+        {
+            case profileTransition:
+                Serial.print(F("xit"));
+                break;
+
+            case profileLeds:
+                Serial.print(F("leds"));
+                break;
+
+            default:
+                Serial.print(F("frame"));
+                break;
+        }
+    }
+
+  public:
+    uint16_t start()
+    {
+        return micros();
+    }
+
+    void record(ProfileStage stage, uint16_t started)
+    {
+        uint16_t elapsed = uint16_t(micros()) - started;
+        samples[stage][next[stage]] = elapsed;
+        next[stage] = (next[stage] + 1) & (profileWindow - 1);
+        if (filled[stage] < profileWindow)
+        {
+            ++filled[stage];
+        }
+        if (elapsed > peak[stage])
+        {
+            peak[stage] = elapsed;
+        }
+    }
+
+    // One line per stage: name, min, avg and max over the window, and
+    // the peak since the last report, all in microseconds.
+    void report(uint8_t overruns)
+    {
+        for (uint8_t stage = 0; stage < profileStageCount; ++stage)
+        {
+            uint16_t lo = 0xffff;
+            uint16_t hi = 0;
+            uint32_t total = 0;
+            for (uint8_t i = 0; i < filled[stage]; ++i)
+            {
+                uint16_t sample = samples[stage][i];
+                lo = min(lo, sample);
+                hi = max(hi, sample);
+                total += sample;
+            }
+
+            printName(stage);
+            Serial.print(' ');
+            Serial.print(filled[stage] ? lo : 0);
+            Serial.print(' ');
+            Serial.print(filled[stage] ? total / filled[stage] : 0);
+            Serial.print(' ');
+            Serial.print(hi);
+            Serial.print(' ');
+            Serial.println(peak[stage]);
+            peak[stage] = 0;
+        }
+
+        Serial.print(F("overruns "));
+        Serial.println(overruns);
+    }
+};
+
+#else
+
+class Profiler
+{
+  public:
+    uint16_t start()
+    {
+        return 0;
+    }
+
+    void record(ProfileStage, uint16_t)
+    {
+    }
+
+    void report(uint8_t)
+    {
+    }
+};
+
+#endif
@@ -0,0 +1,537 @@
+/*
+  PwmOutput
+
+  Output backends for LedBank. Each backend maps a bank channel to a pin in
+  attach() and sets its duty in write().
+
+  PwmOutput looks up the pin's timer once in attach() and afterwards writes
+  the OCRnx register directly, skipping analogWrite()'s pin-to-timer table
+  walk on every frame. AnalogWriteOutput keeps the plain analogWrite()
+  path; it is the backend on the host and can be selected on the board
+  with ANALOGWRITE_OUTPUT.
+
+  With SOFT_PWM defined, PwmOutput hands pins without a hardware PWM
+  channel (and pins 3 and 11, whose Timer2 the engine takes over) to the
+  SoftPwm bit-angle-modulation engine.
+
+  Values arrive as 8.8 fixed point. 8-bit channels are rounded, or with
+  HIRES_PWM temporally dithered: the fraction left over each frame is
+  carried into the next, so the average duty keeps the full resolution.
+  HIRES_PWM also runs Timer1 in 12-bit phase-correct mode (TOP = 0xff0,
+  1.96 kHz), which gives pins 9 and 10 sixteen times finer steps.
+
+  PinPwmOutput<Pins...> fixes each channel's pin at compile time instead:
+  PwmPin<Pin> maps a hardware PWM pin to its registers, so a channel's
+  write compiles to direct register stores and the backend needs no
+  per-channel tables. The pins are listed in channel order and attach()'s
+  pin argument is not used. It doesn't drive SoftPwm pins; on the host,
+  or with ANALOGWRITE_OUTPUT, it is an AnalogWriteOutput.
+
+  write() only stores the value in a back buffer and marks the channel
+  dirty. commit(), called once per frame after the channel writes, puts
+  every changed channel out together. Timer1 and Timer2 are started in
+  step (see syncPwmTimers()) and the burst is kept clear of their TOP, so
+  their channels that change in the same frame change in the same PWM
+  cycle. Timer0, which also keeps millis(), isn't synced with them.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "Waveform.h"
+
+#if defined(SOFT_PWM) && (!defined(__AVR__) || defined(ANALOGWRITE_OUTPUT))
+#error "SOFT_PWM needs the PwmOutput register backend on AVR"
+#endif
+
+#if defined(HIRES_PWM) && (!defined(__AVR__) || defined(ANALOGWRITE_OUTPUT))
+#error "HIRES_PWM needs the PwmOutput register backend on AVR"
+#endif
+
+#ifdef SOFT_PWM
+#include "SoftPwm.h"
+#endif
+
+// Back buffer of channel values plus a dirty bit per channel.
+template <uint8_t N>
+class FrameBuffer
+{
+    uint16_t value[N];
+    uint8_t dirty[(N + 7) / 8] = {};
+
+  public:
+    void set(uint8_t ch, uint16_t v)
+    {
+        value[ch] = v;
+        dirty[ch >> 3] |= 1 << (ch & 7);
+    }
+
+    // Calls put(ch, value) for each dirty channel. A channel stays dirty
+    // for the next frame if put() returns true.
+    template <class Put>
+    void flush(Put put)
+    {
+        for (uint8_t i = 0; i < sizeof(dirty); ++i)
+        {
+            uint8_t bits = dirty[i];
+            uint8_t keep = 0;
+            for (uint8_t ch = i * 8, bit = 1; bits; ++ch, bits >>= 1, bit <<= 1)
+            {
+                if ((bits & 1) && put(ch, value[ch]))
+                {
+                    keep |= bit;
+                }
+            }
+            dirty[i] = keep;
+        }
+    }
+};
+
+template <uint8_t N>
+class AnalogWriteOutput
+{
+    uint8_t pin[N];
+    uint8_t shown[N];    // skips analogWrite() when the rounded value holds
+    FrameBuffer<N> frame;
+
+  public:
+    void attach(uint8_t ch, uint8_t pn)
+    {
+        pin[ch] = pn;
+        shown[ch] = 0;
+        pinMode(pn, OUTPUT);
+        analogWrite(pn, 0);
+    }
+
+    void write(uint8_t ch, uint16_t value)
+    {
+        frame.set(ch, value);
+    }
+
+    void commit()
+    {
+        frame.flush([this](uint8_t ch, uint16_t value) {
+            uint8_t duty = round8(value);
+            if (duty != shown[ch])
+            {
+                shown[ch] = duty;
+                analogWrite(pin[ch], duty);
+            }
+            return false;
+        });
+    }
+};
+
+#if defined(__AVR__) && !defined(ANALOGWRITE_OUTPUT)
+
+#ifdef HIRES_PWM
+const uint16_t hiresTop = 0x0ff0;    // 0xff00 >> 4
+
+// Mode 10: phase-correct PWM with TOP in ICR1, no prescaler.
+inline void startHiresTimer1()
+{
+    TCCR1B = 0;
+    ICR1 = hiresTop;
+    TCCR1A = (TCCR1A & (_BV(COM1A1) | _BV(COM1B1))) | _BV(WGM11);
+    TCCR1B = _BV(WGM13) | _BV(CS10);
+}
+#endif
+
+// The core runs Timer1 and Timer2 alike, 8-bit phase-correct PWM at /64,
+// and both take new OCR values at TOP. They only reach TOP together
+// once their prescalers and counters are restarted as one; then the
+// engine's pins 9, 10 and 11 change in the same PWM cycle. It also resets
+// Timer0's prescaler, which costs millis() a few us once. Under HIRES_PWM
+// or SOFT_PWM the two timers run different cycles and can't line up.
+inline void syncPwmTimers()
+{
+#if !defined(HIRES_PWM) && !defined(SOFT_PWM)
+    uint8_t sreg = SREG;
+    cli();
+    GTCCR = _BV(TSM) | _BV(PSRASY) | _BV(PSRSYNC);
+    TCNT1 = 0;
+    TCNT2 = 0;
+    GTCCR = 0;
+    SREG = sreg;
+#endif
+}
+
+// Call with interrupts off before a burst of OCR writes, so that it can't
+// straddle TOP and land in two PWM cycles. Around TOP the synced counters
+// stay at 248 or above for about 60 us, far longer than a burst takes.
+inline void waitClearOfPwmTop()
+{
+#if !defined(HIRES_PWM) && !defined(SOFT_PWM)
+    while (TCNT2 >= 248)
+    {
+    }
+#endif
+}
+
+template <uint8_t N>
+class PwmOutput
+{
+    volatile uint8_t* ocr[N];
+    volatile uint8_t* tccr[N];
+    uint8_t com[N];
+    uint8_t pin[N];
+#ifdef SOFT_PWM
+    uint8_t soft[N];
+#endif
+#ifdef HIRES_PWM
+    bool wide[N];
+    uint8_t residual[N];
+#endif
+    FrameBuffer<N> frame;
+
+  public:
+    void attach(uint8_t ch, uint8_t pn)
+    {
+        pin[ch] = pn;
+        ocr[ch] = nullptr;
+#ifdef HIRES_PWM
+        wide[ch] = false;
+        residual[ch] = 0;
+#endif
+        pinMode(pn, OUTPUT);
+        digitalWrite(pn, LOW);
+
+        // Timer1's OCR registers are 16 bit and a low byte write takes the
+        // high byte from the shared TEMP register. A full write of 0 here
+        // leaves TEMP clear, and nothing else in the sketch writes a
+        // non-zero high byte. With HIRES_PWM every Timer1 write is a full
+        // 16-bit one.
+        switch (digitalPinToTimer(pn))
+        {
+            case TIMER0A:
+                ocr[ch] = &OCR0A;
+                tccr[ch] = &TCCR0A;
+                com[ch] = _BV(COM0A1);
+                break;
+
+            case TIMER0B:
+                ocr[ch] = &OCR0B;
+                tccr[ch] = &TCCR0A;
+                com[ch] = _BV(COM0B1);
+                break;
+
+            case TIMER1A:
+                OCR1A = 0;
+                ocr[ch] = &OCR1AL;
+                tccr[ch] = &TCCR1A;
+                com[ch] = _BV(COM1A1);
+#ifdef HIRES_PWM
+                wide[ch] = true;
+                startHiresTimer1();
+#endif
+                break;
+
+            case TIMER1B:
+                OCR1B = 0;
+                ocr[ch] = &OCR1BL;
+                tccr[ch] = &TCCR1A;
+                com[ch] = _BV(COM1B1);
+#ifdef HIRES_PWM
+                wide[ch] = true;
+                startHiresTimer1();
+#endif
+                break;
+
+#ifndef SOFT_PWM
+            case TIMER2A:
+                ocr[ch] = &OCR2A;
+                tccr[ch] = &TCCR2A;
+                com[ch] = _BV(COM2A1);
+                break;
+
+            case TIMER2B:
+                ocr[ch] = &OCR2B;
+                tccr[ch] = &TCCR2A;
+                com[ch] = _BV(COM2B1);
+                break;
+#endif
+        }
+        syncPwmTimers();
+
+#ifdef SOFT_PWM
+        soft[ch] = ocr[ch] ? SoftPwm::none : softPwm.attach(pn);
+#endif
+    }
+
+    void write(uint8_t ch, uint16_t value)
+    {
+#ifdef SOFT_PWM
+        if (soft[ch] != SoftPwm::none)
+        {
+            softPwm.write(soft[ch], round8(value));
+            return;
+        }
+#endif
+        frame.set(ch, value);
+    }
+
+    // The registers are written with interrupts off and clear of TOP, so
+    // the whole burst reaches the pins in the same cycle of the synced
+    // Timer1 and Timer2. Timer0 runs on its own and its pins may change
+    // a cycle apart from the others.
+    void commit()
+    {
+        uint8_t sreg = SREG;
+        cli();
+        waitClearOfPwmTop();
+        frame.flush([this](uint8_t ch, uint16_t value) {
+            volatile uint8_t* reg = ocr[ch];
+            if (!reg)
+            {
+                // Not a PWM pin: analogWrite() falls back to on/off.
+                analogWrite(pin[ch], round8(value));
+                return false;
+            }
+
+            bool again = false;
+#ifdef HIRES_PWM
+            uint16_t duty;
+            if (wide[ch])
+            {
+                duty = value >> 4;
+            }
+            else
+            {
+                uint16_t sum = value + residual[ch];
+                duty = sum >> 8;
+                residual[ch] = sum & 0xff;
+                again = value & 0xff;
+            }
+#else
+            uint8_t duty = round8(value);
+#endif
+
+            // Timer0 runs fast PWM, where OCR == 0 still gives a 1/256
+            // glint, so a dark channel is disconnected from the timer.
+            if (duty)
+            {
+#ifdef HIRES_PWM
+                if (wide[ch])
+                {
+                    *(volatile uint16_t*)reg = duty;
+                }
+                else
+#endif
+                {
+                    *reg = duty;
+                }
+                *tccr[ch] |= com[ch];
+            }
+            else
+            {
+                *tccr[ch] &= ~com[ch];
+            }
+            return again;
+        });
+        SREG = sreg;
+
+#ifdef SOFT_PWM
+        softPwm.commit();
+#endif
+    }
+};
+
+// Only the Nano's hardware PWM pins have a specialization. set() takes an
+// 8-bit duty, or for Timer1 under HIRES_PWM a 12-bit one.
+template <uint8_t Pin>
+struct PwmPin;
+
+template <>
+struct PwmPin<3>
+{
+    static const bool wide = false;
+    static volatile uint8_t& tccr() { return TCCR2A; }
+    static const uint8_t com = _BV(COM2B1);
+    static void attach() {}
+    static void set(uint16_t duty) { OCR2B = duty; }
+};
+
+template <>
+struct PwmPin<5>
+{
+    static const bool wide = false;
+    static volatile uint8_t& tccr() { return TCCR0A; }
+    static const uint8_t com = _BV(COM0B1);
+    static void attach() {}
+    static void set(uint16_t duty) { OCR0B = duty; }
+};
+
+template <>
+struct PwmPin<6>
+{
+    static const bool wide = false;
+    static volatile uint8_t& tccr() { return TCCR0A; }
+    static const uint8_t com = _BV(COM0A1);
+    static void attach() {}
+    static void set(uint16_t duty) { OCR0A = duty; }
+};
+
+// As in PwmOutput::attach(), a full write of 0 leaves TEMP clear for the
+// low byte writes after it.
+template <>
+struct PwmPin<9>
+{
+#ifdef HIRES_PWM
+    static const bool wide = true;
+    static void attach() { OCR1A = 0; startHiresTimer1(); }
+    static void set(uint16_t duty) { OCR1A = duty; }
+#else
+    static const bool wide = false;
+    static void attach() { OCR1A = 0; }
+    static void set(uint16_t duty) { OCR1AL = duty; }
+#endif
+    static volatile uint8_t& tccr() { return TCCR1A; }
+    static const uint8_t com = _BV(COM1A1);
+};
+
+template <>
+struct PwmPin<10>
+{
+#ifdef HIRES_PWM
+    static const bool wide = true;
+    static void attach() { OCR1B = 0; startHiresTimer1(); }
+    static void set(uint16_t duty) { OCR1B = duty; }
+#else
+    static const bool wide = false;
+    static void attach() { OCR1B = 0; }
+    static void set(uint16_t duty) { OCR1BL = duty; }
+#endif
+    static volatile uint8_t& tccr() { return TCCR1A; }
+    static const uint8_t com = _BV(COM1B1);
+};
+
+template <>
+struct PwmPin<11>
+{
+    static const bool wide = false;
+    static volatile uint8_t& tccr() { return TCCR2A; }
+    static const uint8_t com = _BV(COM2A1);
+    static void attach() {}
+    static void set(uint16_t duty) { OCR2A = duty; }
+};
+
+// The pin of channel I onwards, picked by a chain of compile-time
+// channel compares.
+template <uint8_t I, uint8_t... Pins>
+struct PwmPinList
+{
+    static void attach(uint8_t) {}
+
+    static bool put(uint8_t, uint16_t, uint8_t*)
+    {
+        return false;
+    }
+};
+
+template <uint8_t I, uint8_t Pin, uint8_t... Rest>
+struct PwmPinList<I, Pin, Rest...>
+{
+    typedef PwmPin<Pin> Hw;
+#ifdef SOFT_PWM
+    static_assert(Pin != 3 && Pin != 11, "Timer2 belongs to SoftPwm");
+#endif
+
+    static void attach(uint8_t ch)
+    {
+        if (ch != I)
+        {
+            PwmPinList<I + 1, Rest...>::attach(ch);
+            return;
+        }
+        pinMode(Pin, OUTPUT);
+        digitalWrite(Pin, LOW);
+        Hw::attach();
+        syncPwmTimers();
+    }
+
+    // Same rounding, dithering and disconnecting as PwmOutput. residual
+    // is the HIRES_PWM carry, one byte per channel.
+    static bool put(uint8_t ch, uint16_t value, uint8_t* residual)
+    {
+        if (ch != I)
+        {
+            return PwmPinList<I + 1, Rest...>::put(ch, value, residual);
+        }
+
+        bool again = false;
+#ifdef HIRES_PWM
+        uint16_t duty;
+        if (Hw::wide)
+        {
+            duty = value >> 4;
+        }
+        else
+        {
+            uint16_t sum = value + residual[I];
+            duty = sum >> 8;
+            residual[I] = sum & 0xff;
+            again = value & 0xff;
+        }
+#else
+        (void)residual;
+        uint8_t duty = round8(value);
+#endif
+
+        if (duty)
+        {
+            Hw::set(duty);
+            Hw::tccr() |= Hw::com;
+        }
+        else
+        {
+            Hw::tccr() &= ~Hw::com;
+        }
+        return again;
+    }
+};
+
+template <uint8_t... Pins>
+class PinPwmOutput
+{
+    static const uint8_t N = sizeof...(Pins);
+    typedef PwmPinList<0, Pins...> Channels;
+
+#ifdef HIRES_PWM
+    uint8_t residual[N] = {};
+#else
+    static constexpr uint8_t* residual = nullptr;
+#endif
+    FrameBuffer<N> frame;
+
+  public:
+    void attach(uint8_t ch, uint8_t)
+    {
+        Channels::attach(ch);
+    }
+
+    void write(uint8_t ch, uint16_t value)
+    {
+        frame.set(ch, value);
+    }
+
+    // As PwmOutput::commit().
+    void commit()
+    {
+        uint8_t sreg = SREG;
+        cli();
+        waitClearOfPwmTop();
+        frame.flush([this](uint8_t ch, uint16_t value) {
+            return Channels::put(ch, value, residual);
+        });
+        SREG = sreg;
+    }
+};
+
+#else
+
+template <uint8_t N>
+using PwmOutput = AnalogWriteOutput<N>;
+
+template <uint8_t... Pins>
+using PinPwmOutput = AnalogWriteOutput<sizeof...(Pins)>;
+
+#endif
@@ -0,0 +1,68 @@
+/*
+  Random
+
+  Cheap pseudo-random numbers. Arduino's random() runs avr-libc's 32-bit
+  generator plus a 32-bit modulo, hundreds of cycles per call. A 16-bit
+  xorshift step takes a handful of shifts, and ranges are mapped with a
+  multiply and a shift instead of a modulo.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "SimCost.h"
+
+// Marsaglia xorshift with the (7, 9, 8) triple: period 2^16 - 1, and the
+// state must never be zero.
+inline uint16_t xorshift16(uint16_t& state)
+{
+    SIM_COST(simOpXorshift);
+    state ^= state << 7;
+    state ^= state >> 9;
+    state ^= state << 8;
+    return state;
+}
+
+// Map r to 0 <= x < n.
+inline uint16_t scaleRandom(uint16_t r, uint16_t n)
+{
+    SIM_COST(simOpMul16);
+    return (uint32_t(r) * n) >> 16;
+}
+
+class FastRandom
+{
+    uint16_t state = 1;
+
+  public:
+    void seed(uint32_t s)
+    {
+        state = uint16_t(s) ^ uint16_t(s >> 16);
+        if (state == 0)
+        {
+            state = 1;
+        }
+    }
+
+    // For storing and later passing back to seed().
+    uint16_t saveState() const
+    {
+        return state;
+    }
+
+    uint16_t next()
+    {
+        return xorshift16(state);
+    }
+
+    // 0 <= x < n.
+    uint16_t below(uint16_t n)
+    {
+        return scaleRandom(xorshift16(state), n);
+    }
+
+    // lo <= x < hi, or lo if hi <= lo.
+    uint16_t range(uint16_t lo, uint16_t hi)
+    {
+        return hi > lo ? lo + below(hi - lo) : lo;
+    }
+};
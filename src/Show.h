@@ -0,0 +1,88 @@
+/*
+  Show
+
+  Record formats for the show table. Each show state lists the commands
+  to run when it is entered and a weighted list of states to move on to.
+  All of it lives in flash and is copied into SRAM one record at a time
+  while a state is being entered.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+enum class ShowOp : uint8_t
+{
+    off,
+    on,
+    ramp,
+    sinusoid,
+    flicker,
+    pinkFlicker,
+    engine
+};
+
+struct ShowCommand
+{
+    uint8_t light;      // LED bank channel
+    ShowOp op;
+    uint8_t level;      // target/max brightness, or the EngineState
+    uint8_t minLevel;   // sinusoid and flicker minimum
+    uint16_t period;    // ramp/sinusoid period, or flicker mean | jitter << 8, in ms
+    int16_t offset;     // ramp/flicker delay or sinusoid phase in ms
+    uint16_t jitter;    // random extra offset, 0 <= extra < jitter
+};
+
+struct ShowTransition
+{
+    uint8_t weight;
+    uint8_t next;           // state to switch to
+    uint16_t minDuration;   // time in this state, min <= t < max
+    uint16_t maxDuration;
+};
+
+struct ShowState
+{
+    const ShowCommand* commands;
+    uint8_t commandCount;
+    const ShowTransition* transitions;
+    uint8_t transitionCount;
+};
+
+constexpr ShowCommand showOff(uint8_t light)
+{
+    return {light, ShowOp::off, 0, 0, 0, 0, 0};
+}
+
+constexpr ShowCommand showOn(uint8_t light, uint8_t level)
+{
+    return {light, ShowOp::on, level, 0, 0, 0, 0};
+}
+
+constexpr ShowCommand showRamp(uint8_t light, uint8_t level, uint16_t period, int16_t delay = 0)
+{
+    return {light, ShowOp::ramp, level, 0, period, delay, 0};
+}
+
+constexpr ShowCommand showSinusoid(uint8_t light, uint16_t period, uint8_t mn, uint8_t mx, int16_t phase = 0)
+{
+    return {light, ShowOp::sinusoid, mx, mn, period, phase, 0};
+}
+
+constexpr ShowCommand showFlicker(uint8_t light, uint8_t mn, uint8_t mx, int16_t delay, uint16_t delayJitter = 0,
+    uint8_t mean = 29, uint8_t jitter = 12, bool pink = false)
+{
+    return {light, pink ? ShowOp::pinkFlicker : ShowOp::flicker, mx, mn, uint16_t(mean | jitter << 8),
+        delay, delayJitter};
+}
+
+template <class State>
+constexpr ShowCommand showEngine(State state)
+{
+    return {0, ShowOp::engine, uint8_t(state), 0, 0, 0, 0};
+}
+
+template <size_t C, size_t T>
+constexpr ShowState showState(const ShowCommand (&commands)[C], const ShowTransition (&transitions)[T])
+{
+    return {commands, C, transitions, T};
+}
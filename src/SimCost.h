@@ -0,0 +1,18 @@
+/*
+  SimCost
+
+  Marks the animation math for the host simulator's cycle estimate, which
+  otherwise only sees calls into the core: per-channel evaluations, the
+  multiplies behind the fixed-point helpers, and event queue work. Each
+  SIM_COST(op) bumps the sim's counter for op (see sim/SimCore.h); on the
+  board it compiles to nothing.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+#ifdef FALCON_SIM
+#define SIM_COST(op) simCount(op)
+#else
+#define SIM_COST(op)
+#endif
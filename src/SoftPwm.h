@@ -0,0 +1,151 @@
+/*
+  SoftPwm
+
+  Bit-angle-modulation (BAM) engine for driving LEDs at 8-bit resolution
+  from plain GPIO pins, for the channels beyond the Nano's six hardware
+  PWM outputs.
+
+  Each 8-bit value is shown as eight bit planes, where plane k is held for
+  2^k time units. All channels that share a port are updated with a single
+  port write per plane, so the ISR cost doesn't depend on the channel
+  count. It takes a few microseconds, eight times per 8.2 ms cycle
+  (~122 Hz).
+
+  Every timer already drives PWM pins, so the engine takes over Timer2.
+  Timer2 runs free in normal mode with a /256 prescaler (16 us ticks), and
+  its compare-match A interrupt steps OCR2A forward by 2^(k+1) ticks for
+  each plane. Pins 3 and 11 lose their hardware PWM and become BAM
+  channels like any other pin.
+
+  The planes are double buffered. commit() rebuilds the back buffer after
+  values change, and the ISR swaps buffers at the start of a cycle, so a
+  channel never shows a mix of old and new bits.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+#ifndef SOFT_PWM_CHANNELS
+#define SOFT_PWM_CHANNELS 16
+#endif
+
+// PORTB, PORTC and PORTD, in that order.
+const uint8_t softPwmPorts = 3;
+
+volatile uint8_t softPwmFront = 0;
+volatile bool softPwmSwapPending = false;
+uint8_t softPwmPlane = 0;
+uint8_t softPwmKeep[softPwmPorts] = {0xff, 0xff, 0xff};
+uint8_t softPwmPlanes[2][8][softPwmPorts];
+
+ISR(TIMER2_COMPA_vect)
+{
+    uint8_t plane = softPwmPlane;
+    if (plane == 0 && softPwmSwapPending)
+    {
+        softPwmFront ^= 1;
+        softPwmSwapPending = false;
+    }
+
+    const uint8_t* bits = softPwmPlanes[softPwmFront][plane];
+    PORTB = (PORTB & softPwmKeep[0]) | bits[0];
+    PORTC = (PORTC & softPwmKeep[1]) | bits[1];
+    PORTD = (PORTD & softPwmKeep[2]) | bits[2];
+
+    // Plane 7 lasts 256 ticks, which wraps back to the same compare value.
+    OCR2A += uint8_t(2 << plane);
+    softPwmPlane = (plane + 1) & 7;
+}
+
+class SoftPwm
+{
+    uint8_t count = 0;
+    bool dirty = false;
+
+    uint8_t value[SOFT_PWM_CHANNELS];
+    uint8_t mask[SOFT_PWM_CHANNELS];
+    uint8_t port[SOFT_PWM_CHANNELS];
+
+    void startTimer()
+    {
+        TIMSK2 = 0;
+        TCCR2A = 0;
+        TCCR2B = _BV(CS22) | _BV(CS21);
+        OCR2A = TCNT2 + 2;
+        TIFR2 = _BV(OCF2A);
+        TIMSK2 = _BV(OCIE2A);
+    }
+
+  public:
+    static const uint8_t none = 0xff;
+
+    // Returns the slot driving pn, or none if every slot is taken.
+    uint8_t attach(uint8_t pn)
+    {
+        if (count == SOFT_PWM_CHANNELS)
+        {
+            return none;
+        }
+
+        if (count == 0)
+        {
+            startTimer();
+        }
+
+        pinMode(pn, OUTPUT);
+        digitalWrite(pn, LOW);
+
+        uint8_t slot = count++;
+        value[slot] = 0;
+        mask[slot] = digitalPinToBitMask(pn);
+        port[slot] = digitalPinToPort(pn) - PB;
+        softPwmKeep[port[slot]] &= ~mask[slot];
+        return slot;
+    }
+
+    // True once the last values written are the ones being shown, so that
+    // stopping Timer2 partway through a cycle leaves them on the pins for
+    // fully off and fully on channels.
+    bool idle() const
+    {
+        return !dirty && !softPwmSwapPending;
+    }
+
+    void write(uint8_t slot, uint8_t v)
+    {
+        if (value[slot] != v)
+        {
+            value[slot] = v;
+            dirty = true;
+        }
+    }
+
+    // Rebuild the back planes. While a swap is still pending the ISR may
+    // flip buffers at any moment, so the rebuild waits for the next call.
+    void commit()
+    {
+        if (!dirty || softPwmSwapPending)
+        {
+            return;
+        }
+
+        uint8_t (*back)[softPwmPorts] = softPwmPlanes[softPwmFront ^ 1];
+        memset(back, 0, sizeof(softPwmPlanes[0]));
+        for (uint8_t slot = 0; slot < count; ++slot)
+        {
+            uint8_t v = value[slot];
+            for (uint8_t plane = 0; v; ++plane, v >>= 1)
+            {
+                if (v & 1)
+                {
+                    back[plane][port[slot]] |= mask[slot];
+                }
+            }
+        }
+
+        dirty = false;
+        softPwmSwapPending = true;
+    }
+};
+
+SoftPwm softPwm;
@@ -0,0 +1,192 @@
+/*
+  Sync
+
+  Keeps several controllers in one display on the same show. The master's
+  Serial TX is wired to every follower's RX, and it sends two kinds of
+  packet:
+
+      clock   once every syncClockInterval ms, its current tick
+      state   on every show state change, the new state and the show
+              random state it was picked with
+
+  A follower that reseeds its show random from a state packet before
+  running the state draws the same durations and start offsets as the
+  master did, so the sequence matches without sending them. That adds up
+  to about five bytes a second plus six per state change.
+
+  A follower's ticks() are moved onto the master's clock through
+  tickOffset. A small error is slewed out one tick per frame, so the clock
+  never runs backwards and the animations just run a little fast or slow
+  for a moment. Only the first packet, or one after the link was lost,
+  jumps the clock. Packets are read as they come in, up to a frame late,
+  so only half of each measured error is corrected, which averages out
+  that jitter, and a running drift estimate makes up the difference in
+  crystal speeds.
+
+  Packets are 0xa5, a type, the payload and a checksum. Anything else on
+  the line, such as console replies from the master, is skipped.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "Tick.h"
+
+const uint16_t syncClockInterval = 1000;
+const uint16_t syncTimeout = 3500;     // ms without a packet before a follower runs on its own
+const int16_t syncJumpLimit = 250;     // larger clock errors are jumped, not slewed
+const uint8_t syncBytesPerPoll = 8;
+const uint8_t syncStart = 0xa5;
+
+struct SyncState
+{
+    uint8_t state;
+    uint16_t randomState;
+};
+
+class SyncLink
+{
+    uint8_t packet[4];      // type and payload
+    uint8_t length = 0;
+    bool started = false;
+    bool heard = false;
+    Tick lastHeard = 0;
+    Tick lastClock = 0;
+    int16_t slew = 0;
+    int8_t drift = 0;       // ms the clocks part by per interval
+
+    static uint8_t payloadLength(uint8_t type)
+    {
+        return type == 'c' ? 2 : type == 's' ? 3 : 0;
+    }
+
+    static uint8_t checksum(const uint8_t* bytes, uint8_t count)
+    {
+        uint8_t sum = 0;
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            sum += bytes[i];
+        }
+        return ~sum;
+    }
+
+    static void send(const uint8_t* bytes, uint8_t count)
+    {
+        Serial.write(syncStart);
+        for (uint8_t i = 0; i < count; ++i)
+        {
+            Serial.write(bytes[i]);
+        }
+        Serial.write(checksum(bytes, count));
+    }
+
+    void setClock(Tick master)
+    {
+        int16_t error = master - ticks();
+        if (!locked(ticks()) || error > syncJumpLimit || error < -syncJumpLimit)
+        {
+            tickOffset += error;
+            slew = 0;
+            drift = 0;
+        }
+        else
+        {
+            drift = constrain(drift + error / 4, -20, 20);
+            slew = error / 2 + drift;
+        }
+    }
+
+  public:
+    // Master: call every frame.
+    void sendClock(Tick now)
+    {
+        if (Tick(now - lastClock) < syncClockInterval)
+        {
+            return;
+        }
+        lastClock = now;
+        const uint8_t bytes[] = {'c', uint8_t(now), uint8_t(now >> 8)};
+        send(bytes, sizeof(bytes));
+    }
+
+    // Master: call before running a new show state.
+    void sendState(uint8_t state, uint16_t randomState)
+    {
+        const uint8_t bytes[] = {'s', state, uint8_t(randomState), uint8_t(randomState >> 8)};
+        send(bytes, sizeof(bytes));
+    }
+
+    // Follower: call every frame, before reading the time. Returns true
+    // when the master has changed state.
+    bool poll(SyncState& heardState)
+    {
+        if (slew)
+        {
+            int8_t step = slew > 0 ? 1 : -1;
+            tickOffset += step;
+            slew -= step;
+        }
+
+        for (uint8_t n = 0; n < syncBytesPerPoll; ++n)
+        {
+            int c = Serial.read();
+            if (c < 0)
+            {
+                break;
+            }
+
+            if (!started)
+            {
+                started = c == syncStart;
+                length = 0;
+                continue;
+            }
+
+            if (length == 0 && !payloadLength(c))
+            {
+                started = c == syncStart;
+                continue;
+            }
+
+            if (length == 0 || length < 1 + payloadLength(packet[0]))
+            {
+                packet[length++] = c;
+                continue;
+            }
+
+            // c is the checksum.
+            started = false;
+            if (c != checksum(packet, length))
+            {
+                continue;
+            }
+
+            if (packet[0] == 'c')
+            {
+                setClock(packet[1] | packet[2] << 8);
+            }
+            lastHeard = ticks();
+            heard = true;
+
+            if (packet[0] == 's')
+            {
+                heardState.state = packet[1];
+                heardState.randomState = packet[2] | packet[3] << 8;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Follower: whether the master has been heard from recently enough to
+    // run on its state changes instead of its own. Call every frame: the
+    // link is dropped here once it times out, before now - lastHeard can
+    // wrap around and look recent again.
+    bool locked(Tick now)
+    {
+        if (heard && Tick(now - lastHeard) >= syncTimeout)
+        {
+            heard = false;
+        }
+        return heard;
+    }
+};
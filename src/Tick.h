@@ -0,0 +1,26 @@
+/*
+  Tick
+
+  The sketch's timebase: the low 16 bits of millis(), plus an offset a
+  sync follower keeps on its master's clock. Ticks wrap every 65.5 s, but
+  the difference of two ticks, taken as a Tick, is exact for any interval
+  shorter than that, and every animation and show-state time is.
+  Comparing differences instead of raw ticks keeps the code correct
+  across wraps for any uptime while doing 16-bit math on the AVR.
+
+  Anything that keeps counting past 65 s (a sinusoid's phase, say) has to
+  rebase its start tick as it goes.
+*/
+
+#pragma once
+#include <Arduino.h>
+
+typedef uint16_t Tick;
+
+// Moves ticks() onto another board's clock; see Sync.h.
+Tick tickOffset = 0;
+
+inline Tick ticks()
+{
+    return Tick(millis()) + tickOffset;
+}
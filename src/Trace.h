@@ -0,0 +1,128 @@
+/*
+  Trace
+
+  Records what the LEDs show, so a change to the animation code can be
+  checked against a trace recorded before it (see sim/tracediff.cpp).
+
+  TraceOutput wraps an output backend. Every time a channel's 8-bit duty
+  changes it queues an event in a small ring buffer, and the sketch
+  drains the ring each frame: over Serial on the board, into a file in
+  the host simulator. Events are stamped with the frame time given to
+  setTime(), not when they were written, so a slower build of the same
+  show records the same trace.
+
+  Each event is two bytes: the channel in the high nibble and the ms
+  since the previous event in the low one, then the duty. The first event
+  and any after a gap of 15 ms or more are preceded by a sync record,
+  traceSync and the absolute tick (low byte first). When events had to be
+  dropped because the ring was full, the next sync record is
+  traceDropped instead. Gaps between events have to be under 65 s.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "Tick.h"
+#include "Waveform.h"
+
+const uint8_t traceSync = 0xf0;
+const uint8_t traceDropped = 0xf1;
+const uint8_t traceMaxDelta = 14;
+const uint8_t traceBufferSize = 128;    // power of two
+
+template <uint8_t N, class Output>
+class TraceOutput
+{
+    static_assert(N < 15, "the trace format has room for 15 channels");
+
+    Output output;
+    uint8_t last[N];
+    uint8_t buffer[traceBufferSize];
+    uint8_t head = 0;
+    uint8_t tail = 0;
+    bool synced = false;
+    bool dropped = false;
+    Tick lastEvent = 0;
+    Tick now = 0;
+
+    uint8_t space() const
+    {
+        return (tail - head - 1) & (traceBufferSize - 1);
+    }
+
+    void put(uint8_t byte)
+    {
+        buffer[head] = byte;
+        head = (head + 1) & (traceBufferSize - 1);
+    }
+
+    void record(uint8_t ch, uint8_t duty)
+    {
+        Tick delta = now - lastEvent;
+        bool sync = !synced || delta > traceMaxDelta;
+        if (space() < (sync ? 5 : 2))
+        {
+            dropped = true;
+            synced = false;
+            return;
+        }
+
+        if (sync)
+        {
+            put(dropped ? traceDropped : traceSync);
+            put(now);
+            put(now >> 8);
+            delta = 0;
+            synced = true;
+            dropped = false;
+        }
+        put(ch << 4 | delta);
+        put(duty);
+        lastEvent = now;
+    }
+
+  public:
+    // The backend being traced, for settings of its own.
+    Output& inner()
+    {
+        return output;
+    }
+
+    // Time to stamp the events of the coming frame with.
+    void setTime(Tick frameTime)
+    {
+        now = frameTime;
+    }
+
+    // Calls put(byte) for up to count queued bytes.
+    template <class Put>
+    void drain(Put put, uint8_t count)
+    {
+        while (count-- && tail != head)
+        {
+            put(buffer[tail]);
+            tail = (tail + 1) & (traceBufferSize - 1);
+        }
+    }
+
+    void attach(uint8_t ch, uint8_t pn)
+    {
+        output.attach(ch, pn);
+        last[ch] = 0;
+    }
+
+    void write(uint8_t ch, uint16_t value)
+    {
+        uint8_t duty = round8(value);
+        if (duty != last[ch])
+        {
+            last[ch] = duty;
+            record(ch, duty);
+        }
+        output.write(ch, value);
+    }
+
+    void commit()
+    {
+        output.commit();
+    }
+};
@@ -0,0 +1,157 @@
+/*
+  Waveform
+
+  Fixed-point helpers for the LED animations. The ATmega328 has no FPU, so
+  the per-frame math is done with 8-bit scale factors and a cosine table in
+  flash instead of cos() and float multiplies.
+
+  Levels leave the animations as 8.8 fixed point (0..0xff00 for 0..255),
+  so outputs with more than 8 bits of resolution, or dithering, can use
+  the fraction. Fractions are 0..65535 for 0..1.
+*/
+
+#pragma once
+#include <Arduino.h>
+#include "SimCost.h"
+
+// One period of (cos(2 * pi * (t - 0.5)) + 1) / 2 scaled to 0..255: dark at
+// index 0, full brightness at index 128.
+const uint8_t cosTable[256] PROGMEM = {
+      0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
+     10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
+     37,  40,  42,  44,  47,  49,  52,  54,  57,  59,  62,  65,  67,  70,  73,  76,
+     79,  82,  85,  88,  90,  93,  97, 100, 103, 106, 109, 112, 115, 118, 121, 124,
+    128, 131, 134, 137, 140, 143, 146, 149, 152, 155, 158, 162, 165, 167, 170, 173,
+    176, 179, 182, 185, 188, 190, 193, 196, 198, 201, 203, 206, 208, 211, 213, 215,
+    218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 238, 240, 241, 243, 244,
+    245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+    255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+    245, 244, 243, 241, 240, 238, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+    218, 215, 213, 211, 208, 206, 203, 201, 198, 196, 193, 190, 188, 185, 182, 179,
+    176, 173, 170, 167, 165, 162, 158, 155, 152, 149, 146, 143, 140, 137, 134, 131,
+    128, 124, 121, 118, 115, 112, 109, 106, 103, 100,  97,  93,  90,  88,  85,  82,
+     79,  76,  73,  70,  67,  65,  62,  59,  57,  54,  52,  49,  47,  44,  42,  40,
+     37,  35,  33,  31,  29,  27,  25,  23,  21,  20,  18,  17,  15,  14,  12,  11,
+     10,   9,   7,   6,   5,   5,   4,   3,   2,   2,   1,   1,   1,   0,   0,   0,
+};
+
+// Perceptual brightness to PWM duty, 255 * (i / 255)^2.2. Non-zero inputs
+// never map to 0, so a dim channel stays lit.
+const uint8_t gammaTable[256] PROGMEM = {
+      0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+inline uint8_t gamma8(uint8_t v)
+{
+    return pgm_read_byte(&gammaTable[v]);
+}
+
+// Gamma for an 8.8 level, interpolating between table entries.
+inline uint16_t gamma16(uint16_t v)
+{
+    uint8_t i = v >> 8;
+    uint8_t a = pgm_read_byte(&gammaTable[i]);
+    uint8_t b = i == 255 ? a : pgm_read_byte(&gammaTable[i + 1]);
+    uint16_t base = uint16_t(a) << 8;
+    SIM_COST(simOpMul8);
+    return b >= a ? base + (b - a) * (v & 0xff) : base - (a - b) * (v & 0xff);
+}
+
+// Scale v by s / 256, treating s == 255 as full scale.
+inline uint8_t scale8(uint8_t v, uint8_t s)
+{
+    SIM_COST(simOpMul8);
+    return (uint16_t(v) * (1 + s)) >> 8;
+}
+
+// Interpolate from a (frac == 0) to b (frac == 255).
+inline uint8_t lerp8(uint8_t a, uint8_t b, uint8_t frac)
+{
+    if (b >= a)
+    {
+        return a + scale8(b - a, frac);
+    }
+
+    return a - scale8(a - b, frac);
+}
+
+// Interpolate from a (frac == 0) to b (frac == 65535), as an 8.8 level.
+inline uint16_t lerp16(uint8_t a, uint8_t b, uint16_t frac)
+{
+    SIM_COST(simOpMul16);
+    uint16_t base = uint16_t(a) << 8;
+    if (b >= a)
+    {
+        return base + ((uint32_t(b - a) * frac) >> 8);
+    }
+
+    return base - ((uint32_t(a - b) * frac) >> 8);
+}
+
+// Interpolate between two 8.8 levels.
+inline uint16_t mix16(uint16_t a, uint16_t b, uint8_t frac)
+{
+    SIM_COST(simOpMul16);
+    if (b >= a)
+    {
+        return a + ((uint32_t(b - a) * frac) >> 8);
+    }
+
+    return a - ((uint32_t(a - b) * frac) >> 8);
+}
+
+// Round an 8.8 level to 8 bits.
+inline uint8_t round8(uint16_t v)
+{
+    return (v + 0x80) >> 8;
+}
+
+// Reciprocal of d for fraction16(), as 2^32 / d rounded down.
+inline uint32_t reciprocal(uint16_t d)
+{
+    SIM_COST(simOpDivide);
+    return d ? 0xFFFFFFFFUL / d : 0;
+}
+
+// x / d as a 0..65535 fraction for 0 <= x <= d, where recip is
+// reciprocal(d). Costs one multiply instead of a division.
+inline uint16_t fraction16(uint16_t x, uint32_t recip)
+{
+    SIM_COST(simOpMul32);
+    return (x * recip) >> 16;
+}
+
+// Sample the cosine table at pos, where 65536 is one full period. The high
+// byte selects the table entry and the low byte interpolates to the next.
+inline uint8_t cosWave(uint16_t pos)
+{
+    uint8_t i = pos >> 8;
+    uint8_t a = pgm_read_byte(&cosTable[i]);
+    uint8_t b = pgm_read_byte(&cosTable[uint8_t(i + 1)]);
+    return lerp8(a, b, pos & 0xff);
+}
+
+// cosWave() as a 0..65535 fraction, keeping the interpolated low bits.
+inline uint16_t cosWave16(uint16_t pos)
+{
+    uint8_t i = pos >> 8;
+    uint8_t a = pgm_read_byte(&cosTable[i]);
+    uint8_t b = pgm_read_byte(&cosTable[uint8_t(i + 1)]);
+    uint16_t v = lerp16(a, b, (pos & 0xff) << 8);
+    return v + (v >> 8);
+}